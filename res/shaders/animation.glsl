@@ -0,0 +1,15 @@
+// animated tiles, see tile::TileMapRenderer. Row `a` of uAnimations is animation `a`: its first texel holds
+// (frame count, duration), followed by a texel per frame holding (tile id, end time, u, v). Times are in milliseconds.
+uniform bool uAnimated;
+uniform sampler2D uAnimations;
+uniform uint uTime;
+vec4 animationFrame(int animation) {
+    vec2 header = texelFetch(uAnimations, ivec2(0, animation), 0).xy;
+    int count = int(header.x);
+    float time = float(uTime % uint(header.y));
+    for (int i = 1; i < count; ++i) {
+        vec4 frame = texelFetch(uAnimations, ivec2(i, animation), 0);
+        if (time < frame.y) return frame;
+    }
+    return texelFetch(uAnimations, ivec2(count, animation), 0);
+}
@@ -0,0 +1,7 @@
+// per-frame camera data shared by all programs, must match the layout of Renderer::CameraBlock
+layout (std140) uniform Camera {
+    mat4 uProj;
+    mat4 uView;
+    mat4 uInverseViewProj;
+    vec2 uViewport;
+};
@@ -0,0 +1,7 @@
+#version 330 core
+// copies an image covering the whole viewport, pixel for pixel
+uniform sampler2D uScene;
+out vec4 FragColor;
+void main() {
+    FragColor = texelFetch(uScene, ivec2(gl_FragCoord.xy), 0);
+}
@@ -0,0 +1,9 @@
+#version 330 core
+// a single triangle covering the viewport, passing on the world position of each fragment
+#include "camera.glsl"
+out vec2 vWorld;
+void main() {
+    vec2 ndc = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);
+    vWorld = (uInverseViewProj * vec4(ndc, 0.0, 1.0)).xy;
+    gl_Position = vec4(ndc, 0.0, 1.0);
+}
@@ -0,0 +1,31 @@
+#version 330 core
+// grid lines are computed per fragment from world coordinates
+uniform vec4 uColor;
+uniform vec2 uOrigin;
+uniform vec2 uSize;
+uniform float uCellSize;
+uniform float uThickness;
+in vec2 vWorld;
+out vec4 oFragColor;
+// lines closer together than this many pixels are thinned out
+const float MIN_SPACING = 6.0;
+// coverage of lines every `step` cells, `perPixel` is the size of a pixel in cells
+float lines(vec2 cell, vec2 perPixel, float step) {
+    vec2 distance = abs(fract(cell / step + 0.5) - 0.5) * step / perPixel;
+    vec2 coverage = clamp(uThickness * 0.5 + 0.5 - distance, 0.0, 1.0);
+    return max(coverage.x, coverage.y);
+}
+void main() {
+    vec2 local = vWorld - uOrigin;
+    vec2 perPixel = fwidth(local / uCellSize);
+    // clip to the grid, keeping the outer lines
+    vec2 margin = perPixel * uCellSize * uThickness;
+    if (any(lessThan(local, -margin)) || any(greaterThan(local, uSize + margin))) discard;
+    vec2 cell = local / uCellSize;
+    // when zoomed out, draw every `step`-th line and fade out the ones in between
+    float level = max(log2(MIN_SPACING * max(perPixel.x, perPixel.y)), 0.0);
+    float step = exp2(floor(level));
+    float coverage = max(lines(cell, perPixel, step) * (1.0 - fract(level)), lines(cell, perPixel, step * 2.0));
+    if (coverage <= 0.0) discard;
+    oFragColor = vec4(uColor.rgb, uColor.a * coverage);
+}
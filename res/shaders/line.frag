@@ -0,0 +1,6 @@
+#version 330 core
+in vec4 vColor;
+out vec4 oFragColor;
+void main() {
+    oFragColor = vColor;
+}
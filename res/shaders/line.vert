@@ -0,0 +1,19 @@
+#version 330 core
+// each instance is a Renderer::Segment, expanded to a quad of `aWidth` pixels across in screen space
+layout (location = 0) in vec2 aStart;
+layout (location = 1) in vec2 aEnd;
+layout (location = 2) in vec4 aColor;
+layout (location = 3) in float aWidth;
+#include "camera.glsl"
+out vec4 vColor;
+void main() {
+    vec4 start = uProj * uView * vec4(aStart, 0.0, 1.0);
+    vec4 end = uProj * uView * vec4(aEnd, 0.0, 1.0);
+    vec2 direction = (end.xy - start.xy) * uViewport;
+    vec2 normal = dot(direction, direction) > 0.0 ? normalize(vec2(-direction.y, direction.x)) : vec2(0.0, 1.0);
+    // a triangle strip: start, start, end, end, on alternating sides
+    gl_Position = gl_VertexID < 2 ? start : end;
+    float side = (gl_VertexID & 1) == 0 ? 0.5 : -0.5;
+    gl_Position.xy += normal * side * aWidth * 2.0 / uViewport * gl_Position.w;
+    vColor = aColor;
+}
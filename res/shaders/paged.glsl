@@ -0,0 +1,25 @@
+// images split into pages, see gfx::PageCache. uPageTable has a texel per page of each layer, the rows of each layer
+// above those of the previous one, holding 0 if the page isn't resident or 1 + its slot in the pages image.
+const int PAGE_SIZE = 256;
+uniform usampler2D uPageTable;
+uniform ivec2 uPagedSize;
+uniform int uSlotsPerRow;
+// mip levels of the pages image, each page's levels lie at the page's texel shifted right by the level
+uniform int uPageLevels;
+// drawn where a page is missing, like images which are still loading
+const vec4 MISSING_PAGE = vec4(vec3(128.0 / 255.0), 1.0);
+// texel of the pages image holding `texel` of `layer`, clamped to the edges, or -1 if its page isn't resident
+ivec2 pagedTexel(ivec2 texel, int layer) {
+    texel = clamp(texel, ivec2(0), uPagedSize - 1);
+    ivec2 page = texel / PAGE_SIZE;
+    int pagesY = (uPagedSize.y + PAGE_SIZE - 1) / PAGE_SIZE;
+    int slot = int(texelFetch(uPageTable, ivec2(page.x, page.y + layer * pagesY), 0).r) - 1;
+    if (slot < 0) return ivec2(-1);
+    return ivec2(slot % uSlotsPerRow, slot / uSlotsPerRow) * PAGE_SIZE + texel % PAGE_SIZE;
+}
+// level to sample where a screen pixel spans `dx` and `dy` texels, 0 unless zoomed out, like GL_NEAREST_MIPMAP_NEAREST
+// derivatives have to be taken before any discard, and across tile edges, so they're passed in
+int pagedLevel(vec2 dx, vec2 dy) {
+    float texels = max(length(dx), length(dy));
+    return clamp(int(floor(log2(max(texels, 1.0)) + 0.5)), 0, uPageLevels - 1);
+}
@@ -0,0 +1,6 @@
+// palette-indexed images, see Image::indexed. Palettes have a row of 256 colors per layer.
+uniform bool uIndexed;
+uniform sampler2D uPalette;
+vec4 paletteColor(uint index, float layer) {
+    return texelFetch(uPalette, ivec2(int(index), int(layer)), 0);
+}
@@ -0,0 +1,32 @@
+#version 330 core
+out vec4 FragColor;
+in vec2 vUV;
+flat in float vLayer;
+uniform sampler2D uTexture;
+uniform sampler2DArray uTextureArray;
+uniform usampler2D uIndices;
+uniform usampler2DArray uIndexArray;
+uniform bool uArray;
+// sample the paged image bound instead of uTexture or uIndices, layers are rows of its page table
+uniform bool uPaged;
+#include "palette.glsl"
+#include "paged.glsl"
+void main() {
+    if (uPaged) {
+        vec2 coord = vUV * vec2(uPagedSize);
+        int level = pagedLevel(dFdx(coord), dFdy(coord));
+        ivec2 texel = pagedTexel(ivec2(floor(coord)), int(vLayer));
+        if (texel.x < 0) {
+            FragColor = MISSING_PAGE;
+        } else if (uIndexed) {
+            FragColor = paletteColor(texelFetch(uIndices, texel, 0).r, vLayer);
+        } else {
+            FragColor = texelFetch(uTexture, texel >> level, level);
+        }
+    } else if (uIndexed) {
+        uint index = uArray ? texture(uIndexArray, vec3(vUV, vLayer)).r : texture(uIndices, vUV).r;
+        FragColor = paletteColor(index, uArray ? vLayer : 0.0);
+    } else {
+        FragColor = uArray ? texture(uTextureArray, vec3(vUV, vLayer)) : texture(uTexture, vUV);
+    }
+}
@@ -0,0 +1,23 @@
+#version 330 core
+// per-instance attributes must match the layout of Renderer::QuadInstance
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aUV;
+layout (location = 2) in vec2 iPosition;
+layout (location = 3) in vec2 iScale;
+layout (location = 4) in vec4 iUV;
+layout (location = 5) in float iLayer;
+layout (location = 6) in float iAnimation;
+#include "camera.glsl"
+#include "animation.glsl"
+uniform float uDepth;
+out vec2 vUV;
+flat out float vLayer;
+void main() {
+    vec4 uv = iUV;
+    // every frame of an animation is the same size, only where it's drawn from changes
+    if (uAnimated && iAnimation > 0.0) uv.xy = animationFrame(int(iAnimation) - 1).zw;
+    vUV = aUV * uv.zw + uv.xy;
+    vLayer = iLayer;
+    gl_Position = uProj * uView * vec4(aPos * iScale + iPosition, 0.0, 1.0);
+    gl_Position.z = uDepth;
+}
@@ -0,0 +1,18 @@
+#version 330 core
+out vec4 FragColor;
+in vec2 vUV;
+in vec4 vColor;
+uniform sampler2D uTexture;
+uniform sampler2DArray uTextureArray;
+uniform usampler2D uIndices;
+uniform usampler2DArray uIndexArray;
+uniform bool uArray;
+#include "palette.glsl"
+void main() {
+    if (uIndexed) {
+        uint index = uArray ? texture(uIndexArray, vec3(vUV, 0.0)).r : texture(uIndices, vUV).r;
+        FragColor = vColor * paletteColor(index, 0.0);
+    } else {
+        FragColor = vColor * (uArray ? texture(uTextureArray, vec3(vUV, 0.0)) : texture(uTexture, vUV));
+    }
+}
@@ -0,0 +1,13 @@
+#version 330 core
+// vertices must match the layout of SpriteBatch::Vertex
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aUV;
+layout (location = 2) in vec4 aColor;
+#include "camera.glsl"
+out vec2 vUV;
+out vec4 vColor;
+void main() {
+    vUV = aUV;
+    vColor = aColor;
+    gl_Position = uProj * uView * vec4(aPos, 0.0, 1.0);
+}
@@ -0,0 +1,41 @@
+#version 330 core
+// tile values are decoded like tile::TileId and tile::TileSetId, and mapped to the atlas like TileMap::uv
+uniform usampler2D uTiles;
+// the pages of the tilesets, a layer per tileset id
+uniform sampler2D uPages;
+uniform usampler2D uIndexPages;
+uniform usampler2D uAnimatedTiles;
+#include "palette.glsl"
+#include "paged.glsl"
+#include "animation.glsl"
+uniform vec2 uOrigin;
+uniform float uTileSize;
+uniform int uTilesPerRow[64];
+in vec2 vWorld;
+out vec4 FragColor;
+void main() {
+    // atlas texels are world units, unlike the texel itself this doesn't jump at tile edges
+    int level = pagedLevel(dFdx(vWorld), dFdy(vWorld));
+    vec2 cell = (vWorld - uOrigin) / uTileSize;
+    ivec2 coord = ivec2(floor(cell));
+    if (any(lessThan(coord, ivec2(0))) || any(greaterThanEqual(coord, textureSize(uTiles, 0)))) discard;
+    uint tile = texelFetch(uTiles, coord, 0).r;
+    int tileId = int(tile & 0x3FFu);
+    int tileSetId = int(tile >> 10u);
+    int perRow = uTilesPerRow[tileSetId];
+    // empty tile, or a tileset which doesn't exist
+    if (perRow == 0) discard;
+    if (uAnimated) {
+        int animation = int(texelFetch(uAnimatedTiles, ivec2(tileId, tileSetId), 0).r);
+        if (animation > 0) tileId = int(animationFrame(animation - 1).x);
+    }
+    vec2 texel = (vec2(tileId / perRow, tileId % perRow) + fract(cell)) * uTileSize;
+    ivec2 paged = pagedTexel(ivec2(floor(texel)), tileSetId);
+    if (paged.x < 0) {
+        FragColor = MISSING_PAGE;
+    } else if (uIndexed) {
+        FragColor = paletteColor(texelFetch(uIndexPages, paged, 0).r, float(tileSetId));
+    } else {
+        FragColor = texelFetch(uPages, paged >> level, level);
+    }
+}
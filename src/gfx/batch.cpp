@@ -3,42 +3,51 @@
 
 namespace gfx {
 
-Batch::Batch(size_t size)
-  : capacity_(size)
-  , cursor_(0)
-  , data_()
-  , buffer_()
-{
-    this->data_.resize(size, 0);
-    // allocate empty buffer on GPU with specific capacity
-    // we will always use glBufferSubData to upload vertices
-    glGenBuffers(1, &this->buffer_);
-    glBindBuffer(GL_ARRAY_BUFFER, this->buffer_);
-    glBufferData(GL_ARRAY_BUFFER, this->capacity_, NULL, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, NULL);
+/**
+ * Persistent mapping requires GL 4.4 or ARB_buffer_storage.
+ */
+static bool
+persistent_supported()
+{
+    return GLAD_GL_VERSION_4_4 || glBufferStorage != NULL;
+}
 
-    spdlog::info("New Batch with capacity {}", size);
+Batch::Batch(size_t pageSize, bool persistent)
+  : pageSize_(pageSize)
+  , persistent_(persistent && persistent_supported())
+  , current_(0)
+  , frame_(0)
+  , pages_()
+{
+    this->grow();
+    spdlog::info("New Batch with page size {}{}", pageSize, this->persistent_ ? ", persistently mapped" : "");
 }
 
 Batch::~Batch()
 {
-    glDeleteBuffers(1, &this->buffer_);
+    this->release();
 }
 
 Batch::Batch(Batch&& other)
-  : capacity_(std::exchange(other.capacity_, 0))
-  , cursor_(std::exchange(other.cursor_, 0))
-  , data_(std::move(other.data_))
-  , buffer_(std::exchange(other.buffer_, 0))
-{}
+  : pageSize_(std::exchange(other.pageSize_, 0))
+  , persistent_(other.persistent_)
+  , current_(std::exchange(other.current_, 0))
+  , frame_(std::exchange(other.frame_, 0))
+  , pages_(std::move(other.pages_))
+{
+    other.pages_.clear();
+}
 Batch&
 Batch::operator=(Batch&& other)
 {
     if (this != &other) {
-        this->capacity_ = std::exchange(other.capacity_, 0);
-        this->cursor_ = std::exchange(other.cursor_, 0);
-        this->data_ = std::move(other.data_);
-        this->buffer_ = std::exchange(other.buffer_, 0);
+        this->release();
+        this->pageSize_ = std::exchange(other.pageSize_, 0);
+        this->persistent_ = other.persistent_;
+        this->current_ = std::exchange(other.current_, 0);
+        this->frame_ = std::exchange(other.frame_, 0);
+        this->pages_ = std::move(other.pages_);
+        other.pages_.clear();
     }
     return *this;
 }
@@ -46,45 +55,177 @@ Batch::operator=(Batch&& other)
 void
 Batch::insert(const void* data, size_t length)
 {
-    // it is the caller's responsibility to check for remaining capacity,
-    // and create another batch if necessary
-    assert(this->cursor_ + length < this->data_.capacity());
+    if (length > this->pageSize_) {
+        throw std::length_error(fmt::format("Batch insert of {} bytes exceeds page size {}", length, this->pageSize_));
+    }
+    // continue in the next page, so that the insertion stays contiguous
+    if (this->pages_[this->current_].cursor + length > this->pageSize_) {
+        if (++this->current_ == this->pages_.size()) {
+            this->grow();
+        }
+    }
     // memcpy into our buffer
-    std::memcpy(this->data_.data() + this->cursor_, data, length);
-    this->cursor_ += length;
+    auto& page = this->pages_[this->current_];
+    std::memcpy(this->begin(page) + page.cursor, data, length);
+    page.cursor += length;
 }
 
 void
 Batch::flush()
 {
+    // mapped pages are coherent, writes are visible to the GPU without any further calls
+    if (this->persistent_) {
+        return;
+    }
     // copy CPU -> GPU memory
-    glBindBuffer(GL_ARRAY_BUFFER, this->buffer_);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, this->cursor_, this->data_.data());
-    this->cursor_ = 0;
+    for (size_t i = 0; i < this->pages(); ++i) {
+        auto& page = this->pages_[i];
+        glBindBuffer(GL_ARRAY_BUFFER, page.buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, page.cursor, page.data.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, NULL);
+}
+
+void
+Batch::clear()
+{
+    for (size_t i = 0; i < this->pages(); ++i) {
+        auto& page = this->pages_[i];
+        if (this->persistent_) {
+            // the GPU is reading this region until the draws issued so far complete
+            page.fences[this->frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        page.cursor = 0;
+    }
+    this->current_ = 0;
+    this->frame_ = (this->frame_ + 1) % FRAMES;
+}
+
+void
+Batch::persistent(bool enabled)
+{
+    enabled = enabled && persistent_supported();
+    if (enabled == this->persistent_) {
+        return;
+    }
+    this->release();
+    this->pages_.clear();
+    this->persistent_ = enabled;
+    this->current_ = 0;
+    this->frame_ = 0;
+    this->grow();
+    spdlog::info("Batch switched to {}", enabled ? "persistently mapped pages" : "glBufferSubData pages");
+}
+
+bool
+Batch::persistent() const noexcept
+{
+    return this->persistent_;
+}
+
+size_t
+Batch::pages() const noexcept
+{
+    // the current page is in use, unless it's the first one and empty
+    if (this->pages_.empty() || (this->current_ == 0 && this->pages_[0].cursor == 0)) {
+        return 0;
+    }
+    return this->current_ + 1;
 }
 
 GLuint
-Batch::handle() const noexcept
+Batch::handle(size_t page) const
 {
-    return this->buffer_;
+    return this->pages_.at(page).buffer;
+}
+
+GLintptr
+Batch::offset() const
+{
+    // every page is on the same region of its ring
+    return this->persistent_ ? this->frame_ * this->pageSize_ : 0;
+}
+
+size_t
+Batch::size(size_t page) const
+{
+    return this->pages_.at(page).cursor;
 }
 
 size_t
 Batch::size() const noexcept
 {
-    return this->cursor_;
+    size_t size = 0;
+    for (size_t i = 0; i < this->pages(); ++i) {
+        size += this->pages_[i].cursor;
+    }
+    return size;
 }
 
 size_t
 Batch::capacity() const noexcept
 {
-    return this->capacity_;
+    return this->pages_.size() * this->pageSize_;
 }
 
-size_t
-Batch::remaining() const noexcept
+void
+Batch::grow()
+{
+    Page page { {}, nullptr, {}, 0, 0 };
+    glGenBuffers(1, &page.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, page.buffer);
+    if (this->persistent_) {
+        // immutable storage for FRAMES regions, mapped once for the lifetime of the page
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, this->pageSize_ * FRAMES, NULL, flags);
+        page.mapped = static_cast<uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, this->pageSize_ * FRAMES, flags));
+        if (page.mapped == nullptr) {
+            spdlog::error("Failed to map Batch page");
+            std::abort();
+        }
+    } else {
+        // allocate empty buffer on GPU with specific capacity
+        // we will always use glBufferSubData to upload vertices
+        page.data.resize(this->pageSize_, 0);
+        glBufferData(GL_ARRAY_BUFFER, this->pageSize_, NULL, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, NULL);
+    this->pages_.push_back(std::move(page));
+
+    if (this->pages_.size() > 1) {
+        spdlog::info("Batch grown to {} pages", this->pages_.size());
+    }
+}
+
+void
+Batch::release()
 {
-    return this->capacity_ - (this->cursor_ + 1);
+    for (auto& page : this->pages_) {
+        for (auto& fence : page.fences) {
+            if (fence != NULL) {
+                glDeleteSync(fence);
+            }
+        }
+        // deleting a mapped buffer unmaps it
+        glDeleteBuffers(1, &page.buffer);
+    }
+}
+
+uint8_t*
+Batch::begin(Page& page)
+{
+    if (!this->persistent_) {
+        return page.data.data();
+    }
+    // before the first write this frame, wait until the GPU is done with the region
+    auto& fence = page.fences[this->frame_];
+    if (page.cursor == 0 && fence != NULL) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+    return page.mapped + this->frame_ * this->pageSize_;
 }
 
-} // namespace gfx
\ No newline at end of file
+} // namespace gfx
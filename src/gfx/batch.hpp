@@ -9,16 +9,29 @@ namespace gfx {
 
 /**
  * Batch of vertices.
- * This is a wrapper over an OpenGL buffer object. It manages it's GPU memory.
- * Grab the handle with Batch::handle() and bind it to a VAO, or draw from it directly.
+ * This is a wrapper over a chain of OpenGL buffer objects (pages) of equal size. It manages their GPU memory.
+ * When a page fills up, insertion continues in the next one, allocating it if this is the first time it's needed.
+ * Pages are kept between frames, so once warmed up the batch does not allocate.
+ * Draw each page in use separately, see Batch::pages, Batch::handle, Batch::offset and Batch::size.
+ *
+ * By default, pages are persistently mapped rings of Batch::FRAMES regions, and vertices are written straight into
+ * GPU-visible memory. Each frame uses the next region, and a fence makes sure the GPU is done reading a region
+ * before it is written again. If persistent mapping is disabled or unsupported, vertices are collected
+ * in CPU memory and uploaded with glBufferSubData.
  */
 class Batch
 {
 public:
     /**
-     * @param size maximum batch size
+     * Number of frames a persistently mapped page can be in flight.
      */
-    Batch(size_t size);
+    static const size_t FRAMES = 3;
+
+    /**
+     * @param pageSize size of a single page in bytes
+     * @param persistent whether to use persistently mapped pages, when supported
+     */
+    Batch(size_t pageSize, bool persistent = true);
     ~Batch();
     Batch(const Batch& other) = delete;
     Batch& operator=(const Batch& other) = delete;
@@ -26,20 +39,72 @@ public:
     Batch& operator=(Batch&& other);
 
     /**
-     * Insert data into the batch. Never allocates. Checking for overflow is user's responsibility.
+     * Insert data into the batch. A single insertion is never split across pages,
+     * so inserting whole primitives keeps every page drawable on its own.
+     * Throws if `length` is larger than a page.
      */
     void insert(const void* data, size_t length);
+    /**
+     * Make inserted data visible to the GPU. Call before drawing.
+     */
     void flush();
-    GLuint handle() const noexcept;
+    /**
+     * Start over from the first page, keeping all pages allocated. Call after drawing.
+     */
+    void clear();
+
+    /**
+     * Switch between persistently mapped and glBufferSubData pages, reallocating all pages.
+     * Has no effect when persistent mapping is unsupported.
+     */
+    void persistent(bool enabled);
+    bool persistent() const noexcept;
+
+    /**
+     * Number of pages in use.
+     */
+    size_t pages() const noexcept;
+    GLuint handle(size_t page) const;
+    /**
+     * Offset of this frame's data in every page, in bytes.
+     */
+    GLintptr offset() const;
+    /**
+     * Number of bytes used in `page`.
+     */
+    size_t size(size_t page) const;
+    /**
+     * Number of bytes used in all pages.
+     */
     size_t size() const noexcept;
+    /**
+     * Number of bytes allocated in all pages.
+     */
     size_t capacity() const noexcept;
-    size_t remaining() const noexcept;
 
 private:
-    size_t capacity_;
-    size_t cursor_;
-    std::vector<uint8_t> data_;
-    GLuint buffer_;
+    struct Page
+    {
+        // CPU copy, only when not persistently mapped
+        std::vector<uint8_t> data;
+        // mapped ring of FRAMES regions, only when persistently mapped
+        uint8_t* mapped;
+        std::array<GLsync, FRAMES> fences;
+        size_t cursor;
+        GLuint buffer;
+    }; // struct Page
+
+    void grow();
+    void release();
+    uint8_t* begin(Page& page);
+
+    size_t pageSize_;
+    bool persistent_;
+    // index of the page currently inserted into
+    size_t current_;
+    // region of the mapped rings used this frame
+    size_t frame_;
+    std::vector<Page> pages_;
 
 }; // class Batch
 
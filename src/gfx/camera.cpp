@@ -29,6 +29,7 @@ Camera::resize(int width, int height)
     this->proj_ = glm::ortho(hw, -hw, -hh, hh, -1.f, 1.f);
     this->viewport_.z = this->window_->width();
     this->viewport_.w = this->window_->height();
+    this->window_->invalidate();
 }
 
 void
@@ -38,6 +39,7 @@ Camera::move(glm::vec2 to)
     this->view_ = glm::lookAt(glm::vec3(this->pos_.x, this->pos_.y, 0.f),
         glm::vec3(this->pos_.x, this->pos_.y, 1.f),
         glm::vec3(0.f, 1.f, 0.f));
+    this->window_->invalidate();
 }
 
 void
@@ -47,6 +49,7 @@ Camera::zoom(float wheel)
     float hw = ((float)this->window_->width() / 2.f) / this->zoom_;
     float hh = ((float)this->window_->height() / 2.f) / this->zoom_;
     this->proj_ = glm::ortho(hw, -hw, -hh, hh, -1.f, 1.f);
+    this->window_->invalidate();
 }
 
 void
@@ -65,6 +68,21 @@ Camera::world(glm::vec2 mouse) const
         glm::vec3(mouse.x, this->viewport_.w - mouse.y, 1), this->view_, this->proj_, this->viewport_);
 }
 
+glm::vec4
+Camera::visible() const
+{
+    // un-project the corners of clip space, the projection may be mirrored so take min/max
+    auto inverse = glm::inverse(this->proj_ * this->view_);
+    glm::vec2 min(std::numeric_limits<float>::max());
+    glm::vec2 max(std::numeric_limits<float>::lowest());
+    for (auto corner : { glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(-1, 1), glm::vec2(1, 1) }) {
+        glm::vec2 world = inverse * glm::vec4(corner, 0.f, 1.f);
+        min = glm::min(min, world);
+        max = glm::max(max, world);
+    }
+    return { min.x, min.y, max.x, max.y };
+}
+
 const glm::mat4&
 Camera::projection() const
 {
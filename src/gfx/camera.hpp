@@ -21,6 +21,10 @@ public:
      * Map mouse position from screen to world coordinates
      */
     glm::vec2 world(glm::vec2 mouse) const;
+    /**
+     * World space rectangle visible through the camera, as { left, bottom, right, top }
+     */
+    glm::vec4 visible() const;
 
     const glm::mat4& projection() const;
     const glm::mat4& view() const;
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "framebuffer.hpp"
+
+namespace gfx {
+
+// see Framebuffer::Screen
+static GLuint screen = 0;
+
+Framebuffer::Framebuffer(int width, int height, bool depth, ImageOptions options)
+  : handle_()
+  , color_(GL_TEXTURE_2D, width, height, 1, GL_RGBA8, options)
+  , depth_()
+{
+    glGenFramebuffers(1, &this->handle_);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->handle_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->color_.handle(), 0);
+    if (depth) {
+        // depth is never sampled, so it doesn't need to be a texture
+        glGenRenderbuffers(1, &this->depth_);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->depth_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, NULL);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depth_);
+    }
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        spdlog::error("Framebuffer#{} is incomplete, status {:#x}", this->handle_, status);
+        std::abort();
+    }
+}
+
+Framebuffer::~Framebuffer()
+{
+    glDeleteFramebuffers(1, &this->handle_);
+    glDeleteRenderbuffers(1, &this->depth_);
+}
+
+Framebuffer::Framebuffer(Framebuffer&& other)
+  : handle_(std::exchange(other.handle_, 0))
+  , color_(std::move(other.color_))
+  , depth_(std::exchange(other.depth_, 0))
+{}
+Framebuffer&
+Framebuffer::operator=(Framebuffer&& other)
+{
+    if (this != &other) {
+        glDeleteFramebuffers(1, &this->handle_);
+        glDeleteRenderbuffers(1, &this->depth_);
+        this->handle_ = std::exchange(other.handle_, 0);
+        this->color_ = std::move(other.color_);
+        this->depth_ = std::exchange(other.depth_, 0);
+    }
+    return *this;
+}
+
+void
+Framebuffer::bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, this->handle_);
+    glViewport(0, 0, this->color_.width(), this->color_.height());
+}
+
+void
+Framebuffer::unbind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, screen);
+}
+
+GLuint
+Framebuffer::Screen()
+{
+    return screen;
+}
+
+void
+Framebuffer::SetScreen(GLuint handle)
+{
+    screen = handle;
+    glBindFramebuffer(GL_FRAMEBUFFER, handle);
+}
+
+GLuint
+Framebuffer::handle() const
+{
+    return this->handle_;
+}
+
+const Image&
+Framebuffer::color() const
+{
+    return this->color_;
+}
+
+int
+Framebuffer::width() const
+{
+    return this->color_.width();
+}
+
+int
+Framebuffer::height() const
+{
+    return this->color_.height();
+}
+
+} // namespace gfx
@@ -0,0 +1,59 @@
+#include "pch.h"
+
+#ifndef TEDIT_FRAMEBUFFER_
+#define TEDIT_FRAMEBUFFER_
+
+#include "gfx/gl.h"
+#include "gfx/image.hpp"
+
+namespace gfx {
+
+/**
+ * Offscreen render target.
+ * This is a wrapper over an OpenGL framebuffer object with a single RGBA color attachment,
+ * which can be sampled like any other Image once rendering is done, and optionally a depth attachment.
+ */
+class Framebuffer final
+{
+public:
+    Framebuffer(int width,
+        int height,
+        bool depth = false,
+        ImageOptions options = { GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR });
+    ~Framebuffer();
+    Framebuffer(const Framebuffer& other) = delete;
+    Framebuffer& operator=(const Framebuffer& other) = delete;
+    Framebuffer(Framebuffer&& other);
+    Framebuffer& operator=(Framebuffer&& other);
+
+    /**
+     * Render into this framebuffer, the viewport is set to cover all of it.
+     */
+    void bind() const;
+    /**
+     * Render into the screen again, see Framebuffer::Screen. The viewport is left for the caller to restore.
+     */
+    void unbind() const;
+
+    /**
+     * Framebuffer rendered into whenever no other one is bound, 0 for the window's default framebuffer.
+     * Headless windows don't have one, they set their own Framebuffer instead, see Window::Backend::Headless.
+     */
+    static GLuint Screen();
+    static void SetScreen(GLuint handle);
+
+    GLuint handle() const;
+    const Image& color() const;
+    int width() const;
+    int height() const;
+
+private:
+    GLuint handle_;
+    Image color_;
+    // depth renderbuffer, 0 if there is none
+    GLuint depth_;
+}; // class Framebuffer
+
+} // namespace gfx
+
+#endif // TEDIT_FRAMEBUFFER_
@@ -7,9 +7,15 @@
 #include "gl.h"
 #include "window.hpp"
 #include "image.hpp"
+#include "page_cache.hpp"
+#include "framebuffer.hpp"
 #include "batch.hpp"
+#include "sprite_batch.hpp"
+#include "instance.hpp"
+#include "uniform_buffer.hpp"
 #include "mesh.hpp"
 #include "shader.hpp"
+#include "shader_cache.hpp"
 #include "camera.hpp"
 #include "renderer.hpp"
 // clang-format on
@@ -1,14 +1,188 @@
 
 #include "pch.h"
 #include "image.hpp"
+#include <stb_image_write.h>
 
 namespace gfx {
 
+// bytes copied from a pixel unpack buffer into a texture at a time
+static const size_t UPLOAD_SLICE_BYTES = 1 << 20;
+
+// colors of a palette
+static const int PALETTE_SIZE = 256;
+
+struct Image::Staging
+{
+    ~Staging()
+    {
+        stbi_image_free(this->pixels);
+    }
+
+    // 0 if the image is only kept as pixels
+    GLuint texture;
+    // the texture's storage is allocated by Image::Upload, as part of its budget
+    bool allocated;
+    // mip levels, unless the image turns out to be indexed
+    int levels;
+    int width;
+    int height;
+    // texture of the palette, if the image may be indexed
+    GLuint palette;
+    // whether the pixels are indices, known up front for PNGs with a palette, otherwise once decoded
+    bool indexed;
+    // decoded by a worker thread, RGBA or palette indices, null if decoding failed
+    std::future<uint8_t*> decoding;
+    uint8_t* pixels;
+    // written by the worker thread, like `pixels`
+    std::vector<uint32_t> colors;
+    // mip levels from 1 on, downsampled by the worker thread, like `pixels`
+    std::vector<std::vector<uint8_t>> mips;
+    // pixel unpack buffer holding one slice of rows
+    GLuint buffer;
+    // level being copied into the texture, and its rows copied so far
+    int level;
+    int rows;
+    // keep `pixels` once ready, see ImageOptions::keepPixels
+    bool keep;
+    bool ready;
+    // the image was destroyed before it was ready
+    bool abandoned;
+}; // struct Image::Staging
+
+/**
+ * Mip levels of a `width` x `height` texture sampled with `options`, see ImageOptions::tileSize.
+ * Integer textures can't be filtered, so they never have mip levels.
+ */
+static int
+mip_levels(int width, int height, bool integer, const ImageOptions& options)
+{
+    if (integer || options.filter_min == GL_NEAREST || options.filter_min == GL_LINEAR) {
+        return 1;
+    }
+    int levels = 1;
+    // each level halves the texels per tile, which has to stay a whole number
+    auto tileSize = options.tileSize;
+    while ((std::max(width, height) >> levels) > 0 && (tileSize == 0 || tileSize % (1 << levels) == 0)) {
+        levels++;
+    }
+    return levels;
+}
+
+/**
+ * Downsample RGBA `pixels` into `levels` - 1 mip levels, each half the size of the previous one.
+ * Every texel is sampled bilinearly from the previous level at its center, like Mesa's glGenerateMipmap, which is the
+ * average of the 2x2 texels it covers unless the previous level's size is odd.
+ */
+static std::vector<std::vector<uint8_t>>
+downsample(const uint8_t* pixels, int width, int height, int levels)
+{
+    // the two texels a texel of `size` samples from one `sourceSize` texels wide, and the second one's weight
+    struct Tap
+    {
+        size_t first;
+        size_t second;
+        float weight;
+    }; // struct Tap
+    auto taps = [](int sourceSize, int size) {
+        std::vector<Tap> taps(size);
+        for (int i = 0; i < size; ++i) {
+            auto center = std::max(0.f, (i + 0.5f) * sourceSize / size - 0.5f);
+            auto first = (int)center;
+            taps[i] = { (size_t)first, (size_t)std::min(first + 1, sourceSize - 1), center - first };
+        }
+        return taps;
+    };
+
+    std::vector<std::vector<uint8_t>> mips(std::max(0, levels - 1));
+    for (int level = 1; level < levels; ++level) {
+        auto* source = level == 1 ? pixels : mips[level - 2].data();
+        int sourceWidth = std::max(1, width >> (level - 1)), sourceHeight = std::max(1, height >> (level - 1));
+        int mipWidth = std::max(1, width >> level), mipHeight = std::max(1, height >> level);
+        auto columns = taps(sourceWidth, mipWidth);
+        auto rows = taps(sourceHeight, mipHeight);
+        auto& mip = mips[level - 1];
+        mip.resize((size_t)mipWidth * mipHeight * 4);
+        for (int y = 0; y < mipHeight; ++y) {
+            auto* below = source + rows[y].first * sourceWidth * 4;
+            auto* above = source + rows[y].second * sourceWidth * 4;
+            for (int x = 0; x < mipWidth; ++x) {
+                auto left = columns[x].first * 4, right = columns[x].second * 4;
+                auto wx = columns[x].weight, wy = rows[y].weight;
+                for (int c = 0; c < 4; ++c) {
+                    auto bottom = below[left + c] + (below[right + c] - below[left + c]) * wx;
+                    auto top = above[left + c] + (above[right + c] - above[left + c]) * wx;
+                    auto at = ((size_t)x + (size_t)y * mipWidth) * 4 + c;
+                    mip[at] = (uint8_t)std::lround(bottom + (top - bottom) * wy);
+                }
+            }
+        }
+    }
+    return mips;
+}
+
+/**
+ * Whether `uri` is a PNG file storing its pixels as indices into a palette, according to its IHDR chunk.
+ */
+static bool
+is_indexed_png(const std::string& uri)
+{
+    static const std::array<uint8_t, 8> signature = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    // signature, then IHDR: length, type, width, height, bit depth, color type
+    std::array<uint8_t, 26> header = {};
+    std::ifstream file(uri, std::ios::binary);
+    file.read(reinterpret_cast<char*>(header.data()), header.size());
+    return file && std::equal(signature.begin(), signature.end(), header.begin()) && header[25] == 3;
+}
+
+/**
+ * Replace `count` RGBA pixels with indices into `colors`, in place, if they have at most PALETTE_SIZE colors.
+ * @return false if there are more colors, the pixels and `colors` are then left empty
+ */
+static bool
+index_colors(uint8_t* pixels, size_t count, std::vector<uint32_t>& colors)
+{
+    std::unordered_map<uint32_t, uint8_t> indices;
+    // neighboring pixels tend to have the same color
+    uint32_t last = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t color;
+        std::memcpy(&color, pixels + i * 4, sizeof(color));
+        if (i == 0 || color != last) {
+            if (indices.emplace(color, (uint8_t)colors.size()).second) {
+                if (colors.size() == PALETTE_SIZE) {
+                    colors.clear();
+                    return false;
+                }
+                colors.push_back(color);
+            }
+            last = color;
+        }
+    }
+    uint8_t lastIndex = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t color;
+        std::memcpy(&color, pixels + i * 4, sizeof(color));
+        if (i == 0 || color != last) {
+            last = color;
+            lastIndex = indices[color];
+        }
+        // the index is written behind the pixels still to be read
+        pixels[i] = lastIndex;
+    }
+    return true;
+}
+
 Image::Image(const std::string& uri, GLenum type, ImageOptions options)
   : handle_()
   , width_()
   , height_()
+  , channels_()
+  , layers_(1)
+  , levels_(1)
   , type_(type)
+  , staging_()
+  , palette_()
+  , paletteRevision_(0)
 {
     static std::thread::id gl_thread_id = std::this_thread::get_id();
     assert(std::this_thread::get_id() == gl_thread_id);
@@ -18,12 +192,20 @@ Image::Image(const std::string& uri, GLenum type, ImageOptions options)
     uint8_t* data = stbi_load(uri.c_str(), &this->width_, &this->height_, &this->channels_, 0);
 
     auto format = GL_RGBA;
-    if (this->channels_ < 4)
+    auto internalFormat = GL_RGBA8;
+    if (this->channels_ < 4) {
         format = GL_RGB;
-    if (this->channels_ < 3)
+        internalFormat = GL_RGB8;
+    }
+    if (this->channels_ < 3) {
         format = GL_RG;
-    if (this->channels_ < 2)
-        format = GL_R8;
+        internalFormat = GL_RG8;
+    }
+    if (this->channels_ < 2) {
+        format = GL_RED;
+        internalFormat = GL_R8;
+    }
+    this->levels_ = mip_levels(this->width_, this->height_, false, options);
 
     // upload data to gpu
     glGenTextures(1, &this->handle_);
@@ -32,8 +214,15 @@ Image::Image(const std::string& uri, GLenum type, ImageOptions options)
     glTexParameteri(type, GL_TEXTURE_WRAP_T, options.wrap_t);
     glTexParameteri(type, GL_TEXTURE_MIN_FILTER, options.filter_min);
     glTexParameteri(type, GL_TEXTURE_MAG_FILTER, options.filter_mag);
-    glTexImage2D(type, 0, format, this->width_, this->height_, 0, format, GL_UNSIGNED_BYTE, &data[0]);
-    glGenerateMipmap(type);
+    glTexStorage2D(type, this->levels_, internalFormat, this->width_, this->height_);
+    // rows with fewer than 4 channels aren't necessarily 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(type, 0, 0, 0, this->width_, this->height_, format, GL_UNSIGNED_BYTE, &data[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // levels which are never sampled are never allocated
+    if (this->levels_ > 1) {
+        glGenerateMipmap(type);
+    }
     glBindTexture(type, NULL);
 
     spdlog::info("New Image, handle#{}, {}:{}", this->handle_, this->width_, this->height_);
@@ -42,8 +231,49 @@ Image::Image(const std::string& uri, GLenum type, ImageOptions options)
     stbi_image_free(data);
 }
 
+Image::Image(GLenum type, int width, int height, int layers, GLenum internalFormat, ImageOptions options)
+  : handle_()
+  , width_(width)
+  , height_(height)
+  , channels_()
+  , layers_(layers)
+  , levels_(1)
+  , type_(type)
+  , staging_()
+  , palette_()
+  , paletteRevision_(0)
+{
+    assert(type == GL_TEXTURE_2D_ARRAY || (type == GL_TEXTURE_2D && layers == 1));
+    assert(!options.indexed || internalFormat == GL_R8UI);
+    bool integer = internalFormat == GL_R8UI || internalFormat == GL_R16UI || internalFormat == GL_R32UI;
+
+    if (width > 0 && height > 0) {
+        this->levels_ = mip_levels(width, height, integer, options);
+        glGenTextures(1, &this->handle_);
+        glBindTexture(type, this->handle_);
+        glTexParameteri(type, GL_TEXTURE_WRAP_S, options.wrap_s);
+        glTexParameteri(type, GL_TEXTURE_WRAP_T, options.wrap_t);
+        glTexParameteri(type, GL_TEXTURE_MIN_FILTER, options.filter_min);
+        glTexParameteri(type, GL_TEXTURE_MAG_FILTER, options.filter_mag);
+        // immutable storage, all levels are allocated at once and the texture is always complete
+        if (type == GL_TEXTURE_2D_ARRAY) {
+            glTexStorage3D(type, this->levels_, internalFormat, width, height, layers);
+        } else {
+            glTexStorage2D(type, this->levels_, internalFormat, width, height);
+        }
+        glBindTexture(type, NULL);
+    }
+
+    if (options.indexed) {
+        this->palette_ = std::make_unique<Image>(GL_TEXTURE_2D, PALETTE_SIZE, layers, 1, GL_RGBA8);
+    }
+
+    spdlog::info("New Image, handle#{}, {}:{}:{}", this->handle_, width, height, layers);
+}
+
 Image::~Image()
 {
+    this->abandon();
     glDeleteTextures(1, &this->handle_);
 }
 
@@ -52,21 +282,335 @@ Image::Image(Image&& other)
   , width_(std::exchange(other.width_, 0))
   , height_(std::exchange(other.height_, 0))
   , channels_(std::exchange(other.channels_, 0))
+  , layers_(std::exchange(other.layers_, 0))
+  , levels_(std::exchange(other.levels_, 0))
   , type_(other.type_)
+  , staging_(std::move(other.staging_))
+  , palette_(std::move(other.palette_))
+  , paletteRevision_(other.paletteRevision_)
 {}
 Image&
 Image::operator=(Image&& other)
 {
     if (this != &other) {
+        this->abandon();
+        glDeleteTextures(1, &this->handle_);
         this->handle_ = std::exchange(other.handle_, 0);
         this->width_ = std::exchange(other.width_, 0);
         this->height_ = std::exchange(other.height_, 0);
         this->channels_ = std::exchange(other.channels_, 0);
+        this->layers_ = std::exchange(other.layers_, 0);
+        this->levels_ = std::exchange(other.levels_, 0);
         this->type_ = other.type_;
+        this->staging_ = std::move(other.staging_);
+        this->palette_ = std::move(other.palette_);
+        this->paletteRevision_ = other.paletteRevision_;
     }
     return *this;
 }
 
+Image
+Image::Load(const std::string& uri,
+    ImageOptions options,
+    std::function<void(const uint8_t* pixels, int width, int height)> decoded)
+{
+    // only the header is read here
+    int width = 0, height = 0, channels = 0;
+    if (!stbi_info(uri.c_str(), &width, &height, &channels)) {
+        spdlog::error("Failed to load image {}: {}", uri, stbi_failure_reason());
+        width = height = 0;
+    }
+    // PNGs with a palette are indexed right away, other images only once decoding finds few enough colors
+    bool indexable = options.indexed;
+    options.indexed = options.indexed && is_indexed_png(uri);
+    // integer textures can't be filtered
+    if (options.indexed) {
+        options.filter_min = options.filter_mag = GL_NEAREST;
+    }
+    // kept pixels aren't uploaded, otherwise the image has to fit into a texture
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    bool texture = !options.keepPixels;
+    if (texture && (width > maxSize || height > maxSize)) {
+        spdlog::error("Failed to load image {}: larger than {}x{}", uri, maxSize, maxSize);
+        width = height = 0;
+    }
+    // the texture's storage is only allocated by Image::Upload, allocating hundreds of megabytes takes a while
+    Image image(GL_TEXTURE_2D, 0, 0, 1, options.indexed ? GL_R8UI : GL_RGBA8, options);
+    image.width_ = width;
+    image.height_ = height;
+    if (width == 0 || height == 0) {
+        return image;
+    }
+    // Image::indexed stays false until it's known
+    if (indexable && !options.indexed) {
+        image.palette_ = std::make_unique<Image>(GL_TEXTURE_2D, PALETTE_SIZE, 1, 1, GL_RGBA8);
+    }
+    if (texture) {
+        image.levels_ = mip_levels(width, height, options.indexed, options);
+        glGenTextures(1, &image.handle_);
+        glBindTexture(GL_TEXTURE_2D, image.handle_);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, options.wrap_s);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, options.wrap_t);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.filter_min);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.filter_mag);
+        glBindTexture(GL_TEXTURE_2D, NULL);
+    }
+
+    auto staging = std::make_shared<Staging>();
+    staging->texture = image.handle_;
+    staging->allocated = false;
+    staging->levels = image.levels_;
+    staging->width = width;
+    staging->height = height;
+    staging->palette = indexable ? image.palette_->handle() : 0;
+    staging->indexed = options.indexed;
+    staging->pixels = nullptr;
+    staging->level = 0;
+    staging->rows = 0;
+    staging->keep = options.keepPixels;
+    staging->ready = false;
+    staging->abandoned = false;
+    staging->buffer = 0;
+    // its storage is specified for each slice
+    if (texture) {
+        glGenBuffers(1, &staging->buffer);
+    }
+
+    // rows start at the bottom, like textures
+    stbi_set_flip_vertically_on_load(true);
+    // the worker only writes `colors` and `mips`, which are read once it's done
+    auto* colors = indexable ? &staging->colors : nullptr;
+    auto* mips = &staging->mips;
+    auto levels = staging->levels;
+    auto decode = [uri, width, height, colors, mips, levels, decoded = std::move(decoded)]() {
+        int x = 0, y = 0, channels = 0;
+        uint8_t* pixels = stbi_load(uri.c_str(), &x, &y, &channels, 4);
+        // the file may have changed since its header was read
+        if (pixels == nullptr || x != width || y != height) {
+            spdlog::error("Failed to decode image {}", uri);
+            stbi_image_free(pixels);
+            return (uint8_t*)nullptr;
+        }
+        if (decoded) {
+            decoded(pixels, width, height);
+        }
+        // images with more colors stay RGBA, PNGs with a palette never have more
+        if (colors != nullptr && index_colors(pixels, (size_t)width * height, *colors)) {
+            // integer textures have no mip levels
+            return pixels;
+        }
+        *mips = downsample(pixels, width, height, levels);
+        return pixels;
+    };
+    staging->decoding = std::async(std::launch::async, std::move(decode));
+
+    spdlog::info("Loading image {}, handle#{}", uri, image.handle_);
+    Pending().push_back(staging);
+    image.staging_ = std::move(staging);
+    return image;
+}
+
+size_t
+Image::Upload(std::chrono::microseconds budget)
+{
+    auto& pending = Pending();
+    auto start = std::chrono::steady_clock::now();
+    // a slice is assumed to take as long as the previous one
+    std::chrono::steady_clock::duration slice{};
+    bool uploaded = false;
+    for (auto it = pending.begin(); it != pending.end();) {
+        auto& staging = **it;
+        if (staging.decoding.valid()) {
+            if (staging.decoding.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++it;
+                continue;
+            }
+            staging.pixels = staging.decoding.get();
+            staging.indexed = staging.indexed || !staging.colors.empty();
+        }
+
+        // the texture of an abandoned image is already deleted
+        bool decoded = staging.pixels != nullptr && !staging.abandoned;
+        bool copy = decoded && staging.texture != 0;
+        bool indexed = staging.indexed;
+        // allocating the storage can't be split into slices, so it's only done with budget left, and counts as one
+        if (copy && !staging.allocated) {
+            if (uploaded && std::chrono::steady_clock::now() - start + slice > budget) {
+                break;
+            }
+            glBindTexture(GL_TEXTURE_2D, staging.texture);
+            // integer textures can't be filtered
+            if (indexed) {
+                staging.levels = 1;
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            }
+            glTexStorage2D(
+                GL_TEXTURE_2D, staging.levels, indexed ? GL_R8UI : GL_RGBA8, staging.width, staging.height);
+            staging.allocated = true;
+            uploaded = true;
+        }
+        // rows of indices aren't necessarily 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, indexed ? 1 : 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+        glBindTexture(GL_TEXTURE_2D, copy ? staging.texture : NULL);
+        // level 0, then the mip levels downsampled by the worker
+        while (copy && staging.level < staging.levels) {
+            auto now = std::chrono::steady_clock::now();
+            if (uploaded && now - start + slice > budget) {
+                break;
+            }
+            auto width = std::max(1, staging.width >> staging.level);
+            auto height = std::max(1, staging.height >> staging.level);
+            auto rowSize = (size_t)width * (indexed ? 1 : 4);
+            auto* pixels = staging.level == 0 ? staging.pixels : staging.mips[staging.level - 1].data();
+            // a fresh buffer each slice, so the driver doesn't wait for the previous copy to finish
+            auto rows = std::min(std::max(1, (int)(UPLOAD_SLICE_BYTES / rowSize)), height - staging.rows);
+            auto size = rows * rowSize;
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            auto* mapped = glMapBufferRange(
+                GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            std::memcpy(mapped, pixels + staging.rows * rowSize, size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            // with a buffer bound, the pointer is an offset into it
+            glTexSubImage2D(GL_TEXTURE_2D,
+                staging.level,
+                0,
+                staging.rows,
+                width,
+                rows,
+                indexed ? GL_RED_INTEGER : GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                (const void*)0);
+            staging.rows += rows;
+            if (staging.rows == height) {
+                staging.level++;
+                staging.rows = 0;
+            }
+            uploaded = true;
+            slice = std::chrono::steady_clock::now() - now;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, NULL);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if (copy && staging.level < staging.levels) {
+            // out of budget, the rest waits for the next frame
+            glBindTexture(GL_TEXTURE_2D, NULL);
+            break;
+        }
+
+        if (decoded && indexed) {
+            glBindTexture(GL_TEXTURE_2D, staging.palette);
+            glTexSubImage2D(GL_TEXTURE_2D,
+                0,
+                0,
+                0,
+                (GLsizei)staging.colors.size(),
+                1,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                staging.colors.data());
+        }
+        glBindTexture(GL_TEXTURE_2D, NULL);
+        glDeleteBuffers(1, &staging.buffer);
+        // returning hundreds of megabytes to the system takes a while, so don't hold up the frame with it
+        if (staging.pixels != nullptr && (!staging.keep || staging.abandoned)) {
+            std::thread(stbi_image_free, staging.pixels).detach();
+            staging.pixels = nullptr;
+        }
+        if (!staging.mips.empty()) {
+            std::thread([mips = std::move(staging.mips)]() {}).detach();
+            staging.mips.clear();
+        }
+        staging.ready = true;
+        it = pending.erase(it);
+    }
+    return pending.size();
+}
+
+bool
+Image::ready() const
+{
+    return this->staging_ == nullptr || this->staging_->ready;
+}
+
+const uint8_t*
+Image::data() const
+{
+    return this->staging_ != nullptr && this->staging_->ready ? this->staging_->pixels : nullptr;
+}
+
+std::vector<std::shared_ptr<Image::Staging>>&
+Image::Pending()
+{
+    static std::vector<std::shared_ptr<Staging>> pending;
+    return pending;
+}
+
+void
+Image::abandon()
+{
+    if (this->staging_ == nullptr || this->staging_->ready) {
+        return;
+    }
+    // the worker thread may still be calling back into the image's owner
+    if (this->staging_->decoding.valid()) {
+        this->staging_->decoding.wait();
+    }
+    // its buffer and pixels are released by the next Image::Upload
+    this->staging_->abandoned = true;
+    this->staging_.reset();
+}
+
+bool
+Image::indexed() const
+{
+    // images which may turn out to be indexed have a palette while they load, see Image::Load
+    return this->palette_ != nullptr && (this->staging_ == nullptr || this->staging_->indexed);
+}
+
+const Image*
+Image::palette() const
+{
+    return this->indexed() ? this->palette_.get() : nullptr;
+}
+
+void
+Image::writePalette(int layer, const uint32_t* colors, int count)
+{
+    assert(this->indexed() && layer < this->layers_ && count <= PALETTE_SIZE);
+    this->palette_->write(0, layer, count, 1, GL_RGBA, GL_UNSIGNED_BYTE, colors, count);
+    this->paletteRevision_++;
+}
+
+void
+Image::copyPalette(int layer, const Image& source)
+{
+    assert(this->indexed() && source.indexed() && layer < this->layers_);
+    glCopyImageSubData(source.palette_->handle(),
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        0,
+        this->palette_->handle(),
+        GL_TEXTURE_2D,
+        0,
+        0,
+        layer,
+        0,
+        PALETTE_SIZE,
+        1,
+        1);
+    this->paletteRevision_++;
+}
+
+uint32_t
+Image::paletteRevision() const
+{
+    return this->paletteRevision_;
+}
+
 void
 Image::attach(GLenum slot) const
 {
@@ -80,6 +624,105 @@ Image::detach() const
     glBindTexture(this->type_, NULL);
 }
 
+void
+Image::copy(int layer, const Image& source)
+{
+    assert(this->type_ == GL_TEXTURE_2D_ARRAY && layer < this->layers_);
+    assert(source.width() <= this->width_ && source.height() <= this->height_);
+    assert(!this->indexed() || source.indexed());
+
+    glBindTexture(this->type_, this->handle_);
+    if (this->indexed()) {
+        // rows of indices aren't necessarily 4-byte aligned
+        std::vector<uint8_t> indices((size_t)source.width() * source.height());
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(source.type(), source.handle());
+        glGetTexImage(source.type(), 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, indices.data());
+        glBindTexture(this->type_, this->handle_);
+        glTexSubImage3D(this->type_,
+            0,
+            0,
+            0,
+            layer,
+            source.width(),
+            source.height(),
+            1,
+            GL_RED_INTEGER,
+            GL_UNSIGNED_BYTE,
+            indices.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        this->copyPalette(layer, source);
+    } else {
+        // read back as RGBA, so sources with fewer channels end up in the same format
+        auto pixels = source.pixels();
+        glTexSubImage3D(
+            this->type_, 0, 0, 0, layer, source.width(), source.height(), 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    }
+    glBindTexture(this->type_, NULL);
+}
+
+std::vector<uint8_t>
+Image::pixels() const
+{
+    assert(this->type_ == GL_TEXTURE_2D);
+    // rows of RGBA pixels are always 4-byte aligned, so the default pack alignment is fine
+    std::vector<uint8_t> pixels((size_t)this->width_ * this->height_ * 4);
+    glBindTexture(this->type_, this->handle_);
+    if (this->indexed()) {
+        // indices fill the first quarter, and are replaced by colors from the back
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(this->type_, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, pixels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        auto colors = this->palette_->pixels();
+        for (size_t i = (size_t)this->width_ * this->height_; i-- > 0;) {
+            std::memcpy(&pixels[i * 4], &colors[(size_t)pixels[i] * 4], 4);
+        }
+    } else {
+        glGetTexImage(this->type_, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    }
+    glBindTexture(this->type_, NULL);
+    return pixels;
+}
+
+bool
+Image::save(const std::string& uri) const
+{
+    auto pixels = this->pixels();
+    // rows start at the bottom, like textures
+    stbi_flip_vertically_on_write(true);
+    if (!stbi_write_png(uri.c_str(), this->width_, this->height_, 4, pixels.data(), this->width_ * 4)) {
+        spdlog::error("Failed to save image {}", uri);
+        return false;
+    }
+    spdlog::info("Saved image {}, handle#{}, {}:{}", uri, this->handle_, this->width_, this->height_);
+    return true;
+}
+
+void
+Image::write(int x,
+    int y,
+    int width,
+    int height,
+    GLenum format,
+    GLenum type,
+    const void* data,
+    int stride,
+    int level)
+{
+    assert(level < this->levels_);
+    assert(this->type_ == GL_TEXTURE_2D);
+    // rows of `data` may have any length, so don't assume any alignment
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+    glBindTexture(this->type_, this->handle_);
+    glTexSubImage2D(this->type_, level, x, y, width, height, format, type, data);
+    glBindTexture(this->type_, NULL);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
 GLuint
 Image::handle() const
 {
@@ -98,6 +741,19 @@ Image::height() const
     return this->height_;
 }
 
+int
+Image::layers() const
+{
+    return this->layers_;
+}
+
+int
+Image::levels() const
+{
+    // loaded images which turn out to be indexed have no mip levels
+    return this->staging_ != nullptr && this->staging_->indexed ? 1 : this->levels_;
+}
+
 GLenum
 Image::type() const
 {
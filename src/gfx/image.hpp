@@ -13,32 +13,162 @@ struct ImageOptions
     GLenum wrap_t;
     GLenum filter_min;
     GLenum filter_mag;
+    /**
+     * Store pixels as GL_R8UI indices into a palette, see Image::indexed.
+     * Image::Load does so right away for PNG files which have a palette. Other images are only indexed once decoding
+     * finds they have at most 256 colors, and stay RGBA with mip levels otherwise.
+     */
+    bool indexed = false;
+    /**
+     * Have Image::Load keep the decoded pixels in memory instead of uploading them, see Image::data.
+     * The image then has no texture, only a palette if it's indexed, so it can be of any size, e.g. to be paged in by
+     * a PageCache.
+     */
+    bool keepPixels = false;
+    /**
+     * For atlases of square tiles this many texels wide, or 0. With a mipmap min filter, mip levels then stop where a
+     * texel would cover parts of several tiles, so that sampling a tile at any level never bleeds into its neighbors.
+     * E.g. 32 keeps 6 levels, down to a texel per tile, while 24 only keeps 4.
+     */
+    int tileSize = 0;
 }; // struct ImageOptions
 
 class Image final
 {
 public:
     Image(const std::string& uri, GLenum type, ImageOptions options = { GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST });
+    /**
+     * Creates an empty image, with mip levels if `options` has a mipmap min filter, see Image::levels.
+     * Images of width or height 0 have no texture.
+     * @param type GL_TEXTURE_2D, filled with Image::write, or GL_TEXTURE_2D_ARRAY, filled with Image::copy
+     * @param internalFormat e.g. GL_RGBA8, or GL_R16UI for integer data, GL_R8UI if `options.indexed`
+     */
+    Image(GLenum type,
+        int width,
+        int height,
+        int layers,
+        GLenum internalFormat,
+        ImageOptions options = { GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_NEAREST, GL_NEAREST });
     ~Image();
     Image(const Image& other) = delete;
     Image& operator=(const Image& other) = delete;
     Image(Image&& other);
     Image& operator=(Image&& other);
 
+    /**
+     * Load an image file as a GL_TEXTURE_2D of RGBA8 pixels, without stalling the GL thread, or only as pixels with
+     * ImageOptions::keepPixels.
+     * The file is decoded, and mip levels downsampled, on a worker thread. Image::Upload then allocates the texture
+     * and streams the pixels into it through a pixel unpack buffer, a slice of rows at a time, level by level.
+     * The size is known right away, the pixels once it's ready().
+     * @param decoded called on the worker thread with the decoded RGBA pixels, row by row starting at the bottom
+     */
+    static Image Load(const std::string& uri,
+        ImageOptions options = { GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST },
+        std::function<void(const uint8_t* pixels, int width, int height)> decoded = nullptr);
+    /**
+     * Copy pixels of images loaded with Image::Load into their textures, until about `budget` has passed.
+     * Call once per frame on the GL thread. At least one slice is copied per call, so loading always progresses.
+     * Allocating a texture's storage can't be split, it's only started with budget left, and may overrun it by far,
+     * e.g. llvmpipe zero-fills the storage.
+     * @return the number of images which are not ready yet
+     */
+    static size_t Upload(std::chrono::microseconds budget);
+    /**
+     * Whether all pixels are uploaded, always true unless loaded with Image::Load.
+     * Images which aren't ready should be drawn as a placeholder.
+     */
+    bool ready() const;
+    /**
+     * Pixels of an image loaded with ImageOptions::keepPixels once it's ready(), otherwise null.
+     * RGBA, or palette indices if the image is indexed, row by row starting at the bottom.
+     */
+    const uint8_t* data() const;
+
+    /**
+     * Whether pixels are indices into palette(), which has a row of 256 RGBA8 colors per layer.
+     * Indexed images have to be sampled with an unsigned integer sampler, and can't be filtered.
+     */
+    bool indexed() const;
+    const Image* palette() const;
+    /**
+     * Replace the colors of `layer` of an indexed image, e.g. to preview a variant of it.
+     * @param colors RGBA8, red in the lowest byte
+     */
+    void writePalette(int layer, const uint32_t* colors, int count);
+    /**
+     * Copy the colors of `source`'s first layer to `layer` of this indexed array image.
+     */
+    void copyPalette(int layer, const Image& source);
+    /**
+     * Incremented whenever the palette changes after the image is ready.
+     */
+    uint32_t paletteRevision() const;
+
     void attach(GLenum slot) const;
     void detach() const;
+    /**
+     * Copy `source` into the bottom left corner of `layer` of this array image.
+     * `source` may have any channel count, it is converted to RGBA. If this image is indexed, `source` has to be too,
+     * and its palette is copied along.
+     */
+    void copy(int layer, const Image& source);
+    /**
+     * Upload a `width` x `height` rectangle of pixels to (x, y) of this 2D image.
+     * `data` points at the first pixel of the rectangle, and rows of `data` are `stride` pixels apart.
+     * Mip levels are not updated, unless written to themselves with `level`.
+     */
+    void write(int x,
+        int y,
+        int width,
+        int height,
+        GLenum format,
+        GLenum type,
+        const void* data,
+        int stride,
+        int level = 0);
+    /**
+     * Read back the first layer of this image as RGBA, row by row starting at the bottom.
+     * Indexed images are looked up in their palette.
+     */
+    std::vector<uint8_t> pixels() const;
+    /**
+     * Write the first layer of this image to a PNG file, read back like Image::pixels.
+     * @return false if the file couldn't be written
+     */
+    bool save(const std::string& uri) const;
 
     GLuint handle() const;
     int width() const;
     int height() const;
+    int layers() const;
+    /**
+     * Mip levels the texture is allocated with, 1 unless it's sampled with a mipmap min filter.
+     * The storage is immutable, so the size and levels of an image never change.
+     */
+    int levels() const;
     GLenum type() const;
 
 private:
+    // pixels of an image created with Image::Load, on their way to the texture
+    struct Staging;
+
+    // images created with Image::Load which are not ready yet, in the order they were loaded
+    static std::vector<std::shared_ptr<Staging>>& Pending();
+    // wait for the image to be decoded, so it can be destroyed while loading
+    void abandon();
+
     GLuint handle_;
     int width_;
     int height_;
     int channels_;
+    int layers_;
+    int levels_;
     GLenum type_;
+    std::shared_ptr<Staging> staging_;
+    // only for indexed images
+    std::unique_ptr<Image> palette_;
+    uint32_t paletteRevision_;
 }; // class Image
 
 } // namespace gfx
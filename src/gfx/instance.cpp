@@ -0,0 +1,80 @@
+#include "pch.h"
+#include "instance.hpp"
+
+namespace gfx {
+
+InstanceBuffer::InstanceBuffer(GLenum usage)
+  : usage_(usage)
+  , capacity_(0)
+  , size_(0)
+  , buffer_()
+{
+    glGenBuffers(1, &this->buffer_);
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    glDeleteBuffers(1, &this->buffer_);
+}
+
+InstanceBuffer::InstanceBuffer(InstanceBuffer&& other)
+  : usage_(other.usage_)
+  , capacity_(std::exchange(other.capacity_, 0))
+  , size_(std::exchange(other.size_, 0))
+  , buffer_(std::exchange(other.buffer_, 0))
+{}
+InstanceBuffer&
+InstanceBuffer::operator=(InstanceBuffer&& other)
+{
+    if (this != &other) {
+        glDeleteBuffers(1, &this->buffer_);
+        this->usage_ = other.usage_;
+        this->capacity_ = std::exchange(other.capacity_, 0);
+        this->size_ = std::exchange(other.size_, 0);
+        this->buffer_ = std::exchange(other.buffer_, 0);
+    }
+    return *this;
+}
+
+void
+InstanceBuffer::upload(const void* data, size_t length)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, this->buffer_);
+    if (length > this->capacity_) {
+        // grow geometrically, so that a steadily growing scene doesn't reallocate every frame
+        size_t capacity = std::max(this->capacity_, size_t(1024));
+        while (capacity < length)
+            capacity *= 2;
+        glBufferData(GL_ARRAY_BUFFER, capacity, NULL, this->usage_);
+        this->capacity_ = capacity;
+        spdlog::info("InstanceBuffer#{} grown to {}", this->buffer_, capacity);
+    } else if (this->usage_ == GL_STREAM_DRAW) {
+        // orphan the old storage, so we don't stall on draws still reading from it
+        glBufferData(GL_ARRAY_BUFFER, this->capacity_, NULL, this->usage_);
+    }
+    if (length > 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, length, data);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, NULL);
+    this->size_ = length;
+}
+
+GLuint
+InstanceBuffer::handle() const noexcept
+{
+    return this->buffer_;
+}
+
+size_t
+InstanceBuffer::size() const noexcept
+{
+    return this->size_;
+}
+
+size_t
+InstanceBuffer::capacity() const noexcept
+{
+    return this->capacity_;
+}
+
+} // namespace gfx
@@ -0,0 +1,45 @@
+#include "pch.h"
+
+#ifndef TEDIT_INSTANCE_
+#define TEDIT_INSTANCE_
+
+#include "gfx/gl.h"
+
+namespace gfx {
+
+/**
+ * Buffer of per-instance data.
+ * This is a wrapper over an OpenGL buffer object, which is bound to a Mesh with Mesh::bindInstances.
+ * Unlike Batch, it does not keep a CPU copy of its contents: data is uploaded in one go with InstanceBuffer::upload.
+ */
+class InstanceBuffer
+{
+public:
+    /**
+     * @param usage buffer usage hint, GL_STREAM_DRAW for data replaced every frame, GL_STATIC_DRAW otherwise
+     */
+    InstanceBuffer(GLenum usage = GL_STREAM_DRAW);
+    ~InstanceBuffer();
+    InstanceBuffer(const InstanceBuffer& other) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer& other) = delete;
+    InstanceBuffer(InstanceBuffer&& other);
+    InstanceBuffer& operator=(InstanceBuffer&& other);
+
+    /**
+     * Replace the contents of the buffer. Only allocates if `length` exceeds current capacity.
+     */
+    void upload(const void* data, size_t length);
+    GLuint handle() const noexcept;
+    size_t size() const noexcept;
+    size_t capacity() const noexcept;
+
+private:
+    GLenum usage_;
+    size_t capacity_;
+    size_t size_;
+    GLuint buffer_;
+}; // class InstanceBuffer
+
+} // namespace gfx
+
+#endif // TEDIT_INSTANCE_
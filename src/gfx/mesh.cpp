@@ -27,11 +27,13 @@ gl_sizeof(GLenum type)
 
 Mesh::Mesh(const std::vector<float>& vertices,
     const std::vector<uint32_t>& indices,
-    const std::vector<Attribute>& attributes)
+    const std::vector<Attribute>& attributes,
+    const std::vector<Attribute>& instanceAttributes)
   : vbo_(0)
   , ebo_(0)
   , vao_(0)
   , count_(indices.size())
+  , instanceStride_(0)
 {
     glGenBuffers(1, &this->vbo_);
     glGenBuffers(1, &this->ebo_);
@@ -62,6 +64,20 @@ Mesh::Mesh(const std::vector<float>& vertices,
         offset += gl_sizeof(attribute.type) * attribute.size;
     }
 
+    // instance buffer descriptors
+    // these only describe the layout, the buffer itself is bound later with Mesh::bindInstances
+    int instanceOffset = 0;
+    for (const auto& attribute : instanceAttributes) {
+        glVertexAttribFormat(attribute.location, attribute.size, attribute.type, false, instanceOffset);
+        glVertexAttribBinding(attribute.location, INSTANCE_BINDING);
+        glEnableVertexAttribArray(attribute.location);
+        instanceOffset += gl_sizeof(attribute.type) * attribute.size;
+    }
+    this->instanceStride_ = instanceOffset;
+    if (!instanceAttributes.empty()) {
+        glVertexBindingDivisor(INSTANCE_BINDING, 1);
+    }
+
     glBindVertexArray(NULL);
 }
 
@@ -77,6 +93,7 @@ Mesh::Mesh(Mesh&& other)
   , ebo_(std::exchange(other.ebo_, 0))
   , vao_(std::exchange(other.vao_, 0))
   , count_(std::exchange(other.count_, 0))
+  , instanceStride_(std::exchange(other.instanceStride_, 0))
 {}
 
 Mesh&
@@ -87,6 +104,7 @@ Mesh::operator=(Mesh&& other)
         this->ebo_ = std::exchange(other.ebo_, 0);
         this->vao_ = std::exchange(other.vao_, 0);
         this->count_ = std::exchange(other.count_, 0);
+        this->instanceStride_ = std::exchange(other.instanceStride_, 0);
     }
     return *this;
 }
@@ -97,10 +115,23 @@ Mesh::attach() const
     glBindVertexArray(this->vao_);
 }
 
+void
+Mesh::bindInstances(GLuint buffer, GLintptr offset) const
+{
+    assert(this->instanceStride_ > 0);
+    glBindVertexBuffer(INSTANCE_BINDING, buffer, offset, this->instanceStride_);
+}
+
 void
 Mesh::draw(GLenum mode) const
 {
     glDrawElements(mode, this->count_, GL_UNSIGNED_INT, NULL);
 }
 
+void
+Mesh::draw(GLenum mode, int instances, int first) const
+{
+    glDrawElementsInstancedBaseInstance(mode, this->count_, GL_UNSIGNED_INT, NULL, instances, first);
+}
+
 } // namespace gfx
\ No newline at end of file
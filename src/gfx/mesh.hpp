@@ -16,9 +16,19 @@ struct Attribute
 class Mesh final
 {
 public:
+    /**
+     * Vertex buffer binding point used for per-instance attributes.
+     * Kept clear of the binding points implicitly used by per-vertex attributes.
+     */
+    static const GLuint INSTANCE_BINDING = 15;
+
+    /**
+     * @param instanceAttributes per-instance attributes, sourced from the buffer bound with Mesh::bindInstances
+     */
     Mesh(const std::vector<float>& vertices,
         const std::vector<uint32_t>& indices,
-        const std::vector<Attribute>& attributes);
+        const std::vector<Attribute>& attributes,
+        const std::vector<Attribute>& instanceAttributes = {});
     ~Mesh();
     Mesh(const Mesh& other) = delete;
     Mesh& operator=(const Mesh& other) = delete;
@@ -26,11 +36,20 @@ public:
     Mesh& operator=(Mesh&& other);
 
     void attach() const;
+    /**
+     * Bind `buffer` as the source of per-instance attributes. Mesh must be attached.
+     */
+    void bindInstances(GLuint buffer, GLintptr offset = 0) const;
     void draw(GLenum mode) const;
+    /**
+     * Draw `instances` instances, starting at instance `first` of the bound instance buffer.
+     */
+    void draw(GLenum mode, int instances, int first) const;
 
 private:
     GLuint vbo_, ebo_, vao_;
     int count_;
+    int instanceStride_;
 }; // class Mesh
 
 } // namespace gfx
@@ -0,0 +1,287 @@
+#include "pch.h"
+#include "page_cache.hpp"
+
+namespace gfx {
+
+// colors of a palette, see Image::indexed
+static const int PALETTE_SIZE = 256;
+
+/**
+ * Layout of the slots of a cache of `pages` pages: as square as possible, no larger than what `budget` pays for,
+ * and within the maximum texture size.
+ * @return slots per row, and rows of slots
+ */
+static glm::ivec2
+slot_grid(size_t pages, size_t budget, size_t pageBytes)
+{
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    auto limit = (size_t)std::max(1, maxSize / PageCache::PAGE_SIZE);
+    auto affordable = std::max<size_t>(1, budget / pageBytes);
+    auto count = std::max<size_t>(1, std::min({ affordable, pages, limit * limit }));
+    auto columns = (size_t)std::ceil(std::sqrt((double)count));
+    auto rows = (count + columns - 1) / columns;
+    // the last row would only be partially used, drop it rather than going over budget
+    if (columns * rows > affordable) {
+        rows = std::max<size_t>(1, count / columns);
+    }
+    return { (int)columns, (int)rows };
+}
+
+/**
+ * Bytes of texture memory a page takes up, along with its mip levels if it has any.
+ */
+static size_t
+page_bytes(const ImageOptions& options)
+{
+    auto bytes = (size_t)PageCache::PAGE_SIZE * PageCache::PAGE_SIZE * (options.indexed ? 1 : 4);
+    bool mipmaps = !options.indexed && options.filter_min != GL_NEAREST && options.filter_min != GL_LINEAR;
+    // a full chain of mip levels adds another third
+    return mipmaps ? bytes + bytes / 3 : bytes;
+}
+
+/**
+ * Average 2x2 blocks of the `size` x `size` RGBA texels, in place, weighing colors by their alpha.
+ * Otherwise transparent texels, whose color is usually black, would darken the edges of what's next to them.
+ */
+static void
+downsample(uint8_t* texels, int size)
+{
+    auto half = size / 2;
+    for (int y = 0; y < half; ++y) {
+        for (int x = 0; x < half; ++x) {
+            uint32_t sum[4] = {};
+            for (int i = 0; i < 4; ++i) {
+                auto* texel = texels + ((size_t)(x * 2 + i % 2) + (size_t)(y * 2 + i / 2) * size) * 4;
+                for (int channel = 0; channel < 3; ++channel) {
+                    sum[channel] += texel[channel] * texel[3];
+                }
+                sum[3] += texel[3];
+            }
+            // the block was read in full, and lies behind the texels still to be read
+            auto* out = texels + ((size_t)x + (size_t)y * half) * 4;
+            for (int channel = 0; channel < 3; ++channel) {
+                out[channel] = (uint8_t)(sum[3] == 0 ? 0 : (sum[channel] + sum[3] / 2) / sum[3]);
+            }
+            out[3] = (uint8_t)((sum[3] + 2) / 4);
+        }
+    }
+}
+
+PageCache::PageCache(int width, int height, int layers, size_t budget, ImageOptions options)
+  : width_(width)
+  , height_(height)
+  , layers_(layers)
+  , pagesX_((width + PAGE_SIZE - 1) / PAGE_SIZE)
+  , pagesY_((height + PAGE_SIZE - 1) / PAGE_SIZE)
+  , slotGrid_(slot_grid((size_t)this->pagesX_ * this->pagesY_ * layers, budget, page_bytes(options)))
+  // tiles of an atlas are aligned to this within a page, and so are pages within the pages image
+  , pages_(GL_TEXTURE_2D,
+        this->slotGrid_.x * PAGE_SIZE,
+        this->slotGrid_.y * PAGE_SIZE,
+        1,
+        options.indexed ? GL_R8UI : GL_RGBA8,
+        { options.wrap_s,
+            options.wrap_t,
+            options.filter_min,
+            options.filter_mag,
+            false,
+            false,
+            std::gcd(options.tileSize, PAGE_SIZE) })
+  , table_(GL_TEXTURE_2D, this->pagesX_, this->pagesY_ * layers, 1, GL_R16UI)
+  , palette_()
+  , slotPages_(this->slots(), Slot { 0, 0 })
+  , lru_()
+  , resident_()
+  , free_()
+  , staging_((size_t)PAGE_SIZE * PAGE_SIZE * (options.indexed ? 1 : 4))
+  , frame_(0)
+  , missing_(0)
+{
+    // no page is resident yet
+    std::vector<uint16_t> empty((size_t)this->pagesX_ * this->pagesY_ * layers, 0);
+    this->table_.write(
+        0, 0, this->pagesX_, this->pagesY_ * layers, GL_RED_INTEGER, GL_UNSIGNED_SHORT, empty.data(), this->pagesX_);
+    // taken from the back, so slots fill up from the bottom left
+    for (int slot = this->slots(); slot-- > 0;) {
+        this->free_.push_back(slot);
+    }
+    if (options.indexed) {
+        this->palette_ = std::make_unique<Image>(GL_TEXTURE_2D, PALETTE_SIZE, layers, 1, GL_RGBA8);
+    }
+
+    spdlog::info("New PageCache, {}:{}:{}, {} slots for {} pages, {} mip levels",
+        width,
+        height,
+        layers,
+        this->slots(),
+        (size_t)this->pagesX_ * this->pagesY_ * layers,
+        this->pages_.levels());
+}
+
+void
+PageCache::begin()
+{
+    this->frame_++;
+    this->missing_ = 0;
+}
+
+bool
+PageCache::require(int layer, int x, int y, const Loader& load)
+{
+    assert(layer >= 0 && layer < this->layers_ && x >= 0 && x < this->pagesX_ && y >= 0 && y < this->pagesY_);
+    uint64_t page = (uint64_t)layer << 32 | (uint64_t)y << 16 | (uint64_t)x;
+    auto it = this->resident_.find(page);
+    if (it != this->resident_.end()) {
+        this->lru_.splice(this->lru_.begin(), this->lru_, it->second);
+        this->slotPages_[*it->second].frame = this->frame_;
+        return true;
+    }
+
+    int slot;
+    if (!this->free_.empty()) {
+        slot = this->free_.back();
+        this->free_.pop_back();
+        this->lru_.push_front(slot);
+    } else {
+        // pages required since PageCache::begin are all in front of the others
+        auto lru = std::prev(this->lru_.end());
+        auto& evicted = this->slotPages_[*lru];
+        if (evicted.frame == this->frame_) {
+            this->missing_++;
+            return false;
+        }
+        this->resident_.erase(evicted.page);
+        this->setTable(evicted.page, 0);
+        slot = *lru;
+        this->lru_.splice(this->lru_.begin(), this->lru_, lru);
+    }
+    this->slotPages_[slot] = { page, this->frame_ };
+    this->resident_.emplace(page, this->lru_.begin());
+    std::fill(this->staging_.begin(), this->staging_.end(), 0);
+    load(this->staging_.data());
+    this->upload(slot);
+    this->setTable(page, (uint16_t)(slot + 1));
+    return true;
+}
+
+void
+PageCache::copyPalette(int layer, const Image& source)
+{
+    assert(this->indexed() && source.indexed() && layer < this->layers_);
+    glCopyImageSubData(source.palette()->handle(),
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        0,
+        this->palette_->handle(),
+        GL_TEXTURE_2D,
+        0,
+        0,
+        layer,
+        0,
+        PALETTE_SIZE,
+        1,
+        1);
+}
+
+void
+PageCache::setTable(uint64_t page, uint16_t value)
+{
+    auto layer = (int)(page >> 32), y = (int)(page >> 16 & 0xFFFF), x = (int)(page & 0xFFFF);
+    this->table_.write(x, y + layer * this->pagesY_, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &value, 1);
+}
+
+void
+PageCache::upload(int slot)
+{
+    auto x = (slot % this->slotGrid_.x) * PAGE_SIZE, y = (slot / this->slotGrid_.x) * PAGE_SIZE;
+    auto format = this->indexed() ? GL_RED_INTEGER : GL_RGBA;
+    this->pages_.write(x, y, PAGE_SIZE, PAGE_SIZE, format, GL_UNSIGNED_BYTE, this->staging_.data(), PAGE_SIZE);
+    for (int level = 1, size = PAGE_SIZE / 2; level < this->pages_.levels(); ++level, size /= 2) {
+        downsample(this->staging_.data(), size * 2);
+        this->pages_.write(
+            x >> level, y >> level, size, size, format, GL_UNSIGNED_BYTE, this->staging_.data(), size, level);
+    }
+}
+
+bool
+PageCache::indexed() const
+{
+    return this->palette_ != nullptr;
+}
+
+const Image&
+PageCache::pages() const
+{
+    return this->pages_;
+}
+
+const Image&
+PageCache::table() const
+{
+    return this->table_;
+}
+
+const Image*
+PageCache::palette() const
+{
+    return this->palette_.get();
+}
+
+int
+PageCache::levels() const
+{
+    return this->pages_.levels();
+}
+
+int
+PageCache::width() const
+{
+    return this->width_;
+}
+
+int
+PageCache::height() const
+{
+    return this->height_;
+}
+
+int
+PageCache::layers() const
+{
+    return this->layers_;
+}
+
+int
+PageCache::pagesX() const
+{
+    return this->pagesX_;
+}
+
+int
+PageCache::pagesY() const
+{
+    return this->pagesY_;
+}
+
+int
+PageCache::slots() const
+{
+    return this->slotGrid_.x * this->slotGrid_.y;
+}
+
+int
+PageCache::slotsPerRow() const
+{
+    return this->slotGrid_.x;
+}
+
+size_t
+PageCache::missing() const
+{
+    return this->missing_;
+}
+
+} // namespace gfx
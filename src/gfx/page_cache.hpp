@@ -0,0 +1,125 @@
+#include "pch.h"
+
+#ifndef TEDIT_PAGE_CACHE_
+#define TEDIT_PAGE_CACHE_
+
+#include "gfx/gl.h"
+#include "gfx/image.hpp"
+
+namespace gfx {
+
+/**
+ * A virtual array image of any size, of which only the pages which are needed are kept on the GPU.
+ * Pages are squares of PAGE_SIZE x PAGE_SIZE texels. Those which are resident live in the slots of a single 2D image,
+ * as many as fit into the memory budget. A page table, with a texel per page of each layer, maps pages to slots.
+ *
+ * Pages are required before every draw which samples them, and evicted least recently used first,
+ * but never before the next PageCache::begin. Shaders sample the virtual image through paged.glsl.
+ *
+ * RGBA caches may have mip levels, which are generated for each page as it's loaded. Slots are aligned to the page
+ * size, so a level never mixes texels of different pages, see ImageOptions::tileSize.
+ */
+class PageCache final
+{
+public:
+    static const int PAGE_SIZE = 256;
+
+    /**
+     * Called to load a page which isn't resident yet: it has to write the page's texels to `texels`,
+     * PAGE_SIZE x PAGE_SIZE of them row by row starting at the bottom, which are all transparent or 0 to begin with.
+     * Pages at the right and top edges of the virtual image may only fill part of it.
+     */
+    using Loader = std::function<void(uint8_t* texels)>;
+
+    /**
+     * @param width, height, layers size of the virtual image in texels
+     * @param budget bytes of texture memory resident pages may take up, at least one page is always resident
+     * @param options `indexed` if texels are GL_R8UI palette indices instead of GL_RGBA8 colors, a mipmap min filter
+     *   for mip levels, and `tileSize` if the virtual image is an atlas
+     */
+    PageCache(int width, int height, int layers, size_t budget, ImageOptions options);
+    PageCache(const PageCache& other) = delete;
+    PageCache& operator=(const PageCache& other) = delete;
+
+    /**
+     * Allow pages required so far to be evicted. Call before requiring the pages of the next frame.
+     */
+    void begin();
+    /**
+     * Make page (x, y) of `layer` resident until the next PageCache::begin, loading it if it isn't already.
+     * @return false if every slot holds a page required since PageCache::begin, the page then stays missing
+     */
+    bool require(int layer, int x, int y, const Loader& load);
+    /**
+     * Copy the colors of `source`'s palette to the row of `layer` in the palette of this indexed cache.
+     */
+    void copyPalette(int layer, const Image& source);
+
+    bool indexed() const;
+    /**
+     * The slots, row by row starting at the bottom left.
+     */
+    const Image& pages() const;
+    /**
+     * GL_R16UI image of pagesX() x pagesY() * layers() texels, the rows of each layer above those of the previous one.
+     * Texels hold 0 if the page isn't resident, otherwise 1 + its slot.
+     */
+    const Image& table() const;
+    /**
+     * Only for indexed caches, a row of 256 RGBA8 colors per layer.
+     */
+    const Image* palette() const;
+    /**
+     * Mip levels of each page, see paged.glsl for how they are sampled.
+     */
+    int levels() const;
+    int width() const;
+    int height() const;
+    int layers() const;
+    int pagesX() const;
+    int pagesY() const;
+    int slots() const;
+    int slotsPerRow() const;
+    /**
+     * Pages which couldn't be made resident since the last PageCache::begin.
+     */
+    size_t missing() const;
+
+private:
+    // page key, see `resident_`, and the frame it was last required in
+    struct Slot
+    {
+        uint64_t page;
+        uint64_t frame;
+    }; // struct Slot
+
+    void setTable(uint64_t page, uint16_t value);
+    /**
+     * Upload the page in `staging_` to `slot`, along with its mip levels.
+     */
+    void upload(int slot);
+
+    int width_;
+    int height_;
+    int layers_;
+    int pagesX_;
+    int pagesY_;
+    // slots per row, and rows of slots
+    glm::ivec2 slotGrid_;
+    Image pages_;
+    Image table_;
+    std::unique_ptr<Image> palette_;
+    std::vector<Slot> slotPages_;
+    // slots, from the most to the least recently used, and where each page by layer | y | x is in that list
+    std::list<int> lru_;
+    std::unordered_map<uint64_t, std::list<int>::iterator> resident_;
+    std::vector<int> free_;
+    // texels of the page being loaded, reused for each page
+    std::vector<uint8_t> staging_;
+    uint64_t frame_;
+    size_t missing_;
+}; // class PageCache
+
+} // namespace gfx
+
+#endif // TEDIT_PAGE_CACHE_
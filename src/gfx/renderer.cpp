@@ -3,33 +3,13 @@
 #include "renderer.hpp"
 #include "window.hpp"
 #include "gfx/image.hpp"
+#include "gfx/page_cache.hpp"
 #include "gfx/camera.hpp"
 
 namespace gfx {
 
 // clang-format off
 // TEXTURED QUAD ->
-const char* QUAD_TEX_SHADER_VSRC = 
-"#version 330 core\n"
-"layout (location = 0) in vec2 aPos;\n"
-"layout (location = 1) in vec2 aUV;\n"
-"uniform mat4 uProj;\n"
-"uniform mat4 uView;\n"
-"uniform mat4 uModel;\n"
-"uniform vec4 uUV;\n"
-"out vec2 vUV;\n"
-"void main() {\n"
-"    vUV = aUV * uUV.zw + uUV.xy;\n"
-"    gl_Position = uProj * uView * uModel * vec4(aPos, 0.0, 1.0);\n"
-"}";
-const char* QUAD_TEX_SHADER_FSRC = 
-"#version 330 core\n"
-"out vec4 FragColor;\n"
-"in vec2 vUV;\n"
-"uniform sampler2D uTexture;\n"
-"void main() {\n"
-"    FragColor = texture(uTexture, vUV);\n"
-"}";
 std::vector<float> quad_vertices_tex = { 
     +1.0f, +1.0f, 1.0f, 1.0f, 
     +1.0f, -1.0f, 1.0f, 0.0f,
@@ -44,142 +24,283 @@ std::vector<Attribute> quad_attributes_tex = {
     { 0, 2, GL_FLOAT }, 
     { 1, 2, GL_FLOAT } 
 };
-// <- TEXTURED QUAD
-// COLORED QUAD ->
-const char* QUAD_COL_SHADER_VSRC = 
-"#version 330 core\n"
-"layout (location = 0) in vec2 aPos;\n"
-"uniform mat4 uProj;\n"
-"uniform mat4 uView;\n"
-"uniform mat4 uModel;\n"
-"void main() {\n"
-"    gl_Position = uProj * uView * uModel * vec4(aPos, 0.0, 1.0);\n"
-"}";
-const char* QUAD_COL_SHADER_FSRC = 
-"#version 330 core\n"
-"out vec4 FragColor;\n"
-"uniform vec4 uColor;\n"
-"void main() {\n"
-"    FragColor = uColor;\n"
-"}";
-std::vector<float> quad_vertices_col = { 
-    +1.0f, +1.0f,
-    +1.0f, -1.0f,
-    -1.0f, -1.0f,
-    -1.0f, +1.0f,
-};
-std::vector<uint32_t> quad_indices_col = { 
-    0, 1, 3, 
-    1, 2, 3 
+// must match the layout of Renderer::QuadInstance
+std::vector<Attribute> quad_instance_attributes_tex = { 
+    { 2, 2, GL_FLOAT }, 
+    { 3, 2, GL_FLOAT }, 
+    { 4, 4, GL_FLOAT },
+    { 5, 1, GL_FLOAT },
+    { 6, 1, GL_FLOAT }
 };
-std::vector<Attribute> quad_attributes_col = {
-    { 0, 2, GL_FLOAT }
-};
-// <- COLORED QUAD
-
-// LINE ->
-const char* LINE_SHADER_VSRC =
-"#version 330 core\n"
-"uniform mat4 uProj;\n"
-"uniform mat4 uView;\n"
-"layout(location = 0) in vec2 aPosition;\n"
-"void main() {\n"
-"    gl_Position = uProj * uView * vec4(aPosition, 0.0, 1.0);\n"
-"}";
-const char* LINE_SHADER_FSRC =
-"#version 330 core\n"
-"uniform vec4 uColor;\n"
-"out vec4 oFragColor;\n"
-"void main() {\n"
-"    oFragColor = uColor;\n"
-"}";
-// <- LINE
+static_assert(sizeof(Renderer::QuadInstance) == sizeof(float) * 10, "QuadInstance must be tightly packed");
+static_assert(sizeof(Renderer::Segment) == sizeof(float) * 6, "Segment must be tightly packed");
+// <- TEXTURED QUAD
 // clang-format on
 
-Renderer::Renderer()
-  : shaders_({ Shader(QUAD_TEX_SHADER_VSRC, QUAD_TEX_SHADER_FSRC),
-        Shader(QUAD_COL_SHADER_VSRC, QUAD_COL_SHADER_FSRC),
-        Shader(LINE_SHADER_VSRC, LINE_SHADER_FSRC) })
-  , meshes_({ Mesh(quad_vertices_tex, quad_indices_tex, quad_attributes_tex),
-        Mesh(quad_vertices_col, quad_indices_col, quad_attributes_col),
-        { Batch(2 << 15), 0 } })
+// minimum time between checks for changed shader files
+static const auto SHADER_RELOAD_INTERVAL = std::chrono::milliseconds(250);
+// a cached scene moved by less than this fraction of a pixel away from a whole number of pixels is shifted
+static const float SCENE_SHIFT_TOLERANCE = 0.01f;
+// line segments per batch page
+static const size_t LINE_PAGE_SEGMENTS = 4096;
+
+/**
+ * Pack a color into RGBA with 8 bits per channel, red in the lowest byte.
+ */
+static uint32_t
+pack_color(glm::vec4 color)
+{
+    auto bytes = glm::round(glm::clamp(color, 0.f, 1.f) * 255.f);
+    return (uint32_t)bytes.x | (uint32_t)bytes.y << 8 | (uint32_t)bytes.z << 16 | (uint32_t)bytes.w << 24;
+}
+
+/**
+ * Bind `image` for a shader sampling it like quad_tex.frag: 2D images to unit 0, array images to unit 1,
+ * indexed images to unit 2 or 3 and their palette to unit 4. Animation tables go to units 5 and 6.
+ */
+static void
+bind_image(const Image& image, const Uniform& uArray, const Uniform& uIndexed)
+{
+    bool array = image.type() == GL_TEXTURE_2D_ARRAY;
+    if (image.indexed()) {
+        image.palette()->attach(GL_TEXTURE4);
+        image.attach(array ? GL_TEXTURE3 : GL_TEXTURE2);
+    } else {
+        image.attach(array ? GL_TEXTURE1 : GL_TEXTURE0);
+    }
+    glUniform1i(uArray.location, array);
+    glUniform1i(uIndexed.location, image.indexed());
+}
+
+/**
+ * Bind the pages of `cache` for a shader sampling them through paged.glsl: RGBA pages to `unit`, indexed pages to
+ * `indexUnit` and their palette to unit 4, like bind_image. The page table goes to unit 7.
+ */
+static void
+bind_pages(const PageCache& cache,
+    GLenum unit,
+    GLenum indexUnit,
+    const Uniform& uIndexed,
+    const Uniform& uPagedSize,
+    const Uniform& uSlotsPerRow,
+    const Uniform& uPageLevels)
+{
+    if (cache.indexed()) {
+        cache.palette()->attach(GL_TEXTURE4);
+        cache.pages().attach(indexUnit);
+    } else {
+        cache.pages().attach(unit);
+    }
+    cache.table().attach(GL_TEXTURE7);
+    glUniform1i(uIndexed.location, cache.indexed());
+    glUniform2i(uPagedSize.location, cache.width(), cache.height());
+    glUniform1i(uSlotsPerRow.location, cache.slotsPerRow());
+    glUniform1i(uPageLevels.location, cache.levels());
+}
+
+Renderer::Renderer(const std::string& resources)
+  : shaderDirectory_((fs::absolute(resources) / "shaders").lexically_normal())
+  , shaderCache_((fs::absolute(resources) / "shader_cache").lexically_normal().generic_string())
+  , shaders_({ this->loadShader("quad_tex.vert", "quad_tex.frag"),
+        this->loadShader("sprite.vert", "sprite.frag"),
+        this->loadShader("line.vert", "line.frag"),
+        this->loadShader("fullscreen.vert", "grid.frag"),
+        this->loadShader("fullscreen.vert", "tile_layer.frag"),
+        this->loadShader("fullscreen.vert", "composite.frag") })
+  , meshes_({ Mesh(quad_vertices_tex, quad_indices_tex, quad_attributes_tex, quad_instance_attributes_tex),
+        { Batch(LINE_PAGE_SEGMENTS * sizeof(Segment)), 0 },
+        { 0 } })
+  , sprites_()
   , commands_()
   , uniforms_()
+  , camera_(CAMERA_BINDING, sizeof(CameraBlock))
+  , cameraBlock_()
   , lineColor_(0, 0, 0, 1)
+  , placeholder_(GL_TEXTURE_2D, 1, 1, 1, GL_RGBA8)
+  , uploadBudget_(DEFAULT_UPLOAD_BUDGET)
+  , stats_()
+  , opaquePass_(false)
+  , sampleQueries_()
+  , sceneCache_()
+  , sceneLayers_()
+  , lastShaderCheck_(std::chrono::steady_clock::now())
+  , epoch_(std::chrono::steady_clock::now())
+  , frameTime_()
 {
-    // textured quad shader uniforms
-    this->uniforms_.quad_tex.uProj = this->shaders_.quad_tex.uniform("uProj");
-    this->uniforms_.quad_tex.uView = this->shaders_.quad_tex.uniform("uView");
-    this->uniforms_.quad_tex.uModel = this->shaders_.quad_tex.uniform("uModel");
-    this->uniforms_.quad_tex.uUV = this->shaders_.quad_tex.uniform("uUV");
-    this->uniforms_.quad_tex.uTexture = this->shaders_.quad_tex.uniform("uTexture");
+    // every program reads the camera from the same buffer
+    for (auto* shader : { &this->shaders_.quad_tex,
+             &this->shaders_.sprite,
+             &this->shaders_.line,
+             &this->shaders_.grid,
+             &this->shaders_.tile_layer,
+             &this->shaders_.composite }) {
+        shader->bindUniformBlock("Camera", CAMERA_BINDING);
+    }
 
-    // color quad shader uniforms
-    this->uniforms_.quad_col.uProj = this->shaders_.quad_col.uniform("uProj");
-    this->uniforms_.quad_col.uView = this->shaders_.quad_col.uniform("uView");
-    this->uniforms_.quad_col.uModel = this->shaders_.quad_col.uniform("uModel");
-    this->uniforms_.quad_col.uColor = this->shaders_.quad_col.uniform("uColor");
+    this->gatherUniforms();
 
-    // gather line shader uniforms
-    this->uniforms_.line.uProj = this->shaders_.line.uniform("uProj");
-    this->uniforms_.line.uView = this->shaders_.line.uniform("uView");
-    this->uniforms_.line.uColor = this->shaders_.line.uniform("uColor");
+    uint32_t grey = 0xFF808080;
+    this->placeholder_.write(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &grey, 1);
 
+    // segments are per-instance attributes, the vertex buffer is bound per batch page when drawing
     glGenVertexArrays(1, &this->meshes_.line.vao);
     glBindVertexArray(this->meshes_.line.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, this->meshes_.line.batch.handle());
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(float) * 2, NULL);
-    glEnableVertexAttribArray(0);
+    glVertexAttribFormat(0, 2, GL_FLOAT, false, offsetof(Segment, start));
+    glVertexAttribFormat(1, 2, GL_FLOAT, false, offsetof(Segment, end));
+    glVertexAttribFormat(2, 4, GL_UNSIGNED_BYTE, true, offsetof(Segment, color));
+    glVertexAttribFormat(3, 1, GL_FLOAT, false, offsetof(Segment, width));
+    for (GLuint attribute = 0; attribute < 4; ++attribute) {
+        glVertexAttribBinding(attribute, 0);
+        glEnableVertexAttribArray(attribute);
+    }
+    glVertexBindingDivisor(0, 1);
     glBindVertexArray(NULL);
+
+    glGenVertexArrays(1, &this->meshes_.fullscreen.vao);
 }
 
-void
-Renderer::submit(const Image* image, glm::vec4 uv, glm::mat4 model)
+Shader
+Renderer::loadShader(const std::string& vertex, const std::string& fragment) const
 {
-    this->commands_.quad_tex.push_back({ image, uv, model });
+    return Shader::Load((this->shaderDirectory_ / vertex).generic_string(),
+        (this->shaderDirectory_ / fragment).generic_string(),
+        &this->shaderCache_);
 }
 
 void
-Renderer::submit(glm::vec4 color, glm::mat4 model)
+Renderer::gatherUniforms()
 {
-    this->commands_.quad_col.push_back({ color, model });
+    // textured quad shader uniforms
+    this->uniforms_.quad_tex.uTexture = this->shaders_.quad_tex.uniform("uTexture");
+    this->uniforms_.quad_tex.uTextureArray = this->shaders_.quad_tex.uniform("uTextureArray");
+    this->uniforms_.quad_tex.uIndices = this->shaders_.quad_tex.uniform("uIndices");
+    this->uniforms_.quad_tex.uIndexArray = this->shaders_.quad_tex.uniform("uIndexArray");
+    this->uniforms_.quad_tex.uPalette = this->shaders_.quad_tex.uniform("uPalette");
+    this->uniforms_.quad_tex.uArray = this->shaders_.quad_tex.uniform("uArray");
+    this->uniforms_.quad_tex.uIndexed = this->shaders_.quad_tex.uniform("uIndexed");
+    this->uniforms_.quad_tex.uPaged = this->shaders_.quad_tex.uniform("uPaged");
+    this->uniforms_.quad_tex.uPageTable = this->shaders_.quad_tex.uniform("uPageTable");
+    this->uniforms_.quad_tex.uPagedSize = this->shaders_.quad_tex.uniform("uPagedSize");
+    this->uniforms_.quad_tex.uSlotsPerRow = this->shaders_.quad_tex.uniform("uSlotsPerRow");
+    this->uniforms_.quad_tex.uPageLevels = this->shaders_.quad_tex.uniform("uPageLevels");
+    this->uniforms_.quad_tex.uAnimations = this->shaders_.quad_tex.uniform("uAnimations");
+    this->uniforms_.quad_tex.uAnimated = this->shaders_.quad_tex.uniform("uAnimated");
+    this->uniforms_.quad_tex.uTime = this->shaders_.quad_tex.uniform("uTime");
+    this->uniforms_.quad_tex.uDepth = this->shaders_.quad_tex.uniform("uDepth");
+
+    // sprite shader uniforms
+    this->uniforms_.sprite.uTexture = this->shaders_.sprite.uniform("uTexture");
+    this->uniforms_.sprite.uTextureArray = this->shaders_.sprite.uniform("uTextureArray");
+    this->uniforms_.sprite.uIndices = this->shaders_.sprite.uniform("uIndices");
+    this->uniforms_.sprite.uIndexArray = this->shaders_.sprite.uniform("uIndexArray");
+    this->uniforms_.sprite.uPalette = this->shaders_.sprite.uniform("uPalette");
+    this->uniforms_.sprite.uArray = this->shaders_.sprite.uniform("uArray");
+    this->uniforms_.sprite.uIndexed = this->shaders_.sprite.uniform("uIndexed");
+
+    // gather grid shader uniforms
+    this->uniforms_.grid.uColor = this->shaders_.grid.uniform("uColor");
+    this->uniforms_.grid.uOrigin = this->shaders_.grid.uniform("uOrigin");
+    this->uniforms_.grid.uSize = this->shaders_.grid.uniform("uSize");
+    this->uniforms_.grid.uCellSize = this->shaders_.grid.uniform("uCellSize");
+    this->uniforms_.grid.uThickness = this->shaders_.grid.uniform("uThickness");
+
+    // gather tile layer shader uniforms
+    this->uniforms_.tile_layer.uTiles = this->shaders_.tile_layer.uniform("uTiles");
+    this->uniforms_.tile_layer.uPages = this->shaders_.tile_layer.uniform("uPages");
+    this->uniforms_.tile_layer.uIndexPages = this->shaders_.tile_layer.uniform("uIndexPages");
+    this->uniforms_.tile_layer.uPalette = this->shaders_.tile_layer.uniform("uPalette");
+    this->uniforms_.tile_layer.uIndexed = this->shaders_.tile_layer.uniform("uIndexed");
+    this->uniforms_.tile_layer.uPageTable = this->shaders_.tile_layer.uniform("uPageTable");
+    this->uniforms_.tile_layer.uPagedSize = this->shaders_.tile_layer.uniform("uPagedSize");
+    this->uniforms_.tile_layer.uSlotsPerRow = this->shaders_.tile_layer.uniform("uSlotsPerRow");
+    this->uniforms_.tile_layer.uPageLevels = this->shaders_.tile_layer.uniform("uPageLevels");
+    this->uniforms_.tile_layer.uAnimations = this->shaders_.tile_layer.uniform("uAnimations");
+    this->uniforms_.tile_layer.uAnimatedTiles = this->shaders_.tile_layer.uniform("uAnimatedTiles");
+    this->uniforms_.tile_layer.uAnimated = this->shaders_.tile_layer.uniform("uAnimated");
+    this->uniforms_.tile_layer.uTime = this->shaders_.tile_layer.uniform("uTime");
+    this->uniforms_.tile_layer.uOrigin = this->shaders_.tile_layer.uniform("uOrigin");
+    this->uniforms_.tile_layer.uTileSize = this->shaders_.tile_layer.uniform("uTileSize");
+    this->uniforms_.tile_layer.uTilesPerRow = this->shaders_.tile_layer.uniform("uTilesPerRow[0]");
+
+    // gather composite shader uniforms
+    this->uniforms_.composite.uScene = this->shaders_.composite.uniform("uScene");
+}
+
+bool
+Renderer::reloadShaders()
+{
+    bool reloaded = false;
+    for (auto* shader : { &this->shaders_.quad_tex,
+             &this->shaders_.sprite,
+             &this->shaders_.line,
+             &this->shaders_.grid,
+             &this->shaders_.tile_layer,
+             &this->shaders_.composite }) {
+        reloaded |= shader->reload();
+    }
+    if (reloaded) {
+        this->gatherUniforms();
+        this->invalidateScene();
+    }
+    return reloaded;
 }
 
 void
-Renderer::submit(glm::vec2 start, glm::vec2 end, float thickness)
+Renderer::submit(const Image* image, glm::vec4 uv, glm::mat4 model)
 {
-    auto angle = atan2f(start.y - end.y, start.x - end.x);
-    float x_pad = sinf(angle) * (thickness / 2.f);
-    float y_pad = cosf(angle) * (thickness / 2.f);
-    glm::vec2 bottom_left = { start.x - x_pad, start.y + y_pad };
-    glm::vec2 bottom_right = { start.x + x_pad, start.y - y_pad };
-    glm::vec2 top_left = { end.x - x_pad, end.y + y_pad };
-    glm::vec2 top_right = { end.x + x_pad, end.y - y_pad };
+    this->sprites_.insert(this->resolve(image), { model[3], model[0], model[1], uv, glm::vec4(1.f) });
+}
 
-    float vertices[2 * 6] = {
-        top_left.x,
-        top_left.y,
+void
+Renderer::submit(const Image* image, glm::vec2 position, glm::vec2 scale, glm::vec4 uv, uint8_t layer)
+{
+    this->sprites_.insert(
+        this->resolve(image), { position, { scale.x, 0.f }, { 0.f, scale.y }, uv, glm::vec4(1.f) }, layer);
+}
 
-        bottom_left.x,
-        bottom_left.y,
+void
+Renderer::submit(const InstanceBuffer& instances, const std::vector<TexturedQuadCommand>& commands)
+{
+    for (const auto& command : commands) {
+        this->commands_.quad_tex.push_back({ command.image,
+            &instances,
+            command.first,
+            command.count,
+            command.opaque,
+            command.animations,
+            command.pages });
+    }
+}
 
-        bottom_right.x,
-        bottom_right.y,
+void
+Renderer::submit(glm::vec4 color, glm::mat4 model)
+{
+    this->sprites_.insert(nullptr, { model[3], model[0], model[1], { 0.f, 0.f, 1.f, 1.f }, color });
+}
 
-        bottom_right.x,
-        bottom_right.y,
+void
+Renderer::submit(glm::vec2 start, glm::vec2 end, float thickness)
+{
+    this->submit(start, end, this->lineColor_, thickness);
+}
 
-        top_right.x,
-        top_right.y,
+void
+Renderer::submit(glm::vec2 start, glm::vec2 end, glm::vec4 color, float width)
+{
+    Segment segment { start, end, pack_color(color), width };
+    this->meshes_.line.batch.insert(&segment, sizeof(segment));
+}
 
-        top_left.x,
-        top_left.y,
-    };
+void
+Renderer::submit(const GridCommand& grid)
+{
+    this->commands_.grids.push_back(grid);
+}
 
-    auto& batch = this->meshes_.line.batch;
-    // TODO: overflow check + split batch
-    batch.insert(&vertices[0], sizeof(vertices));
-    this->commands_.lines++;
+void
+Renderer::submit(const TileLayerCommand& layer)
+{
+    this->commands_.tile_layers.push_back(layer);
 }
 
 void
@@ -190,66 +311,539 @@ Renderer::render(Camera& camera)
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glClearColor(149.f / 255.f, 177.f / 255.f, 194.f / 255.f, 1.0f);
 
-    glClear(GL_COLOR_BUFFER_BIT);
+    auto now = std::chrono::steady_clock::now();
+    if (now - this->lastShaderCheck_ >= SHADER_RELOAD_INTERVAL) {
+        this->lastShaderCheck_ = now;
+        this->reloadShaders();
+    }
 
     auto& projection = camera.projection();
     auto& view = camera.view();
-    // TODO: maybe render in one go, so they stay in-order?
-    // render textured quads
-    {
-        this->shaders_.quad_tex.attach();
-        glUniformMatrix4fv(this->uniforms_.quad_tex.uProj.location, 1, false, glm::value_ptr(projection));
-        glUniformMatrix4fv(this->uniforms_.quad_tex.uView.location, 1, false, glm::value_ptr(view));
-        this->meshes_.quad_tex.attach();
-
-        GLuint lastTexture = static_cast<GLuint>(-1);
-        for (const auto& command : this->commands_.quad_tex) {
-            if (GLuint texture = command.image->handle(); texture != lastTexture) {
-                lastTexture = texture;
-                command.image->attach(GL_TEXTURE0);
-                glUniform1i(this->uniforms_.quad_tex.uTexture.location, 0);
-            }
-            glUniform4fv(this->uniforms_.quad_tex.uUV.location, 1, glm::value_ptr(command.uv));
-            glUniformMatrix4fv(this->uniforms_.quad_tex.uModel.location, 1, false, glm::value_ptr(command.model));
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    this->setCamera(projection, view, { viewport[2], viewport[3] });
 
-            this->meshes_.quad_tex.draw(GL_TRIANGLES);
-        }
+    auto pendingImages = this->stats_.pendingImages;
+    this->stats_ = {};
+    auto start = std::chrono::steady_clock::now();
+    this->stats_.pendingImages = Image::Upload(this->uploadBudget_);
+    this->stats_.uploadMilliseconds =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    // images which finished loading may be part of the cached scene, drawn as placeholders
+    if (this->stats_.pendingImages != pendingImages) {
+        this->invalidateScene();
     }
-    // render colored quads
-    {
-        this->shaders_.quad_col.attach();
-        glUniformMatrix4fv(this->uniforms_.quad_col.uProj.location, 1, false, glm::value_ptr(projection));
-        glUniformMatrix4fv(this->uniforms_.quad_col.uView.location, 1, false, glm::value_ptr(view));
-        this->meshes_.quad_col.attach();
-
-        for (const auto& command : this->commands_.quad_col) {
-            glUniform4fv(this->uniforms_.quad_col.uColor.location, 1, glm::value_ptr(command.color));
-            glUniformMatrix4fv(this->uniforms_.quad_col.uModel.location, 1, false, glm::value_ptr(command.model));
-            this->meshes_.quad_col.draw(GL_TRIANGLES);
+
+    // frames the GPU is still working on are left for later, as reading their results would wait for it
+    auto& queries = this->sampleQueries_;
+    while (!queries.pending.empty()) {
+        auto& frame = queries.pending.front();
+        bool available = std::all_of(frame.begin(), frame.end(), [](const std::pair<GLuint, bool>& query) {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(query.first, GL_QUERY_RESULT_AVAILABLE, &available);
+            return available == GL_TRUE;
+        });
+        if (!available) {
+            break;
+        }
+        queries.blended = 0;
+        queries.opaque = 0;
+        for (auto [query, opaque] : frame) {
+            GLuint64 samples = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+            (opaque ? queries.opaque : queries.blended) += samples;
+            queries.free.push_back(query);
         }
+        queries.pending.pop_front();
     }
+    this->stats_.blendedSamples = queries.blended;
+    this->stats_.opaqueSamples = queries.opaque;
+    queries.pending.emplace_back();
 
-    // render lines
-    {
-        this->shaders_.line.attach();
-        glUniformMatrix4fv(this->uniforms_.line.uProj.location, 1, false, glm::value_ptr(projection));
-        glUniformMatrix4fv(this->uniforms_.line.uView.location, 1, false, glm::value_ptr(view));
-        glUniform4fv(this->uniforms_.line.uColor.location, 1, glm::value_ptr(this->lineColor_));
+    this->sceneLayers_.clear();
+    for (const auto& command : this->commands_.quad_tex) {
+        this->sceneLayers_.push_back(command.layer);
+    }
+    for (const auto& tiles : this->commands_.tile_layers) {
+        this->sceneLayers_.push_back(tiles.layer);
+    }
+    for (const auto& grid : this->commands_.grids) {
+        this->sceneLayers_.push_back(grid.layer);
+    }
+    std::sort(this->sceneLayers_.begin(), this->sceneLayers_.end());
+    this->sceneLayers_.erase(
+        std::unique(this->sceneLayers_.begin(), this->sceneLayers_.end()), this->sceneLayers_.end());
 
-        this->meshes_.line.batch.flush();
-        glBindVertexArray(this->meshes_.line.vao);
-        glDrawArrays(GL_TRIANGLES, 0, this->commands_.lines * 6);
+    // the scene below the lowest sprites is drawn in one go, and may be cached
+    this->prepareSprites();
+    uint8_t below = this->sprites_.size() > 0 ? this->sprites_.lowestLayer() : UINT8_MAX;
+    if (this->sceneCache_.enabled) {
+        this->renderCachedScene(projection, view, below);
+    } else {
+        glClear(GL_COLOR_BUFFER_BIT);
+        this->drawScene(0, below);
+    }
+    // then each layer above it, followed by the sprites up to the next one
+    int next = 0;
+    for (auto layer : this->sceneLayers_) {
+        if (layer > below) {
+            this->drawSprites((uint8_t)next, layer - 1);
+            this->drawSceneLayer(layer);
+            next = layer;
+        }
     }
+    this->drawSprites((uint8_t)next, UINT8_MAX);
+    this->sprites_.clear();
+    this->drawLines();
 
     this->commands_.quad_tex.clear();
-    this->commands_.quad_col.clear();
-    this->commands_.lines = 0;
+    this->commands_.grids.clear();
+    this->commands_.tile_layers.clear();
+    this->frameTime_.reset();
+}
+
+void
+Renderer::setCamera(const glm::mat4& projection, const glm::mat4& view, glm::vec2 viewport)
+{
+    CameraBlock block { projection, view, glm::inverse(projection * view), viewport, { 0.f, 0.f } };
+    if (std::memcmp(&block, &this->cameraBlock_, sizeof(CameraBlock)) == 0) {
+        return;
+    }
+    this->cameraBlock_ = block;
+    this->camera_.upload(&block, sizeof(CameraBlock));
+}
+
+void
+Renderer::prepareSprites()
+{
+    auto start = std::chrono::steady_clock::now();
+    this->sprites_.prepare();
+    auto end = std::chrono::steady_clock::now();
+    this->stats_.quads = this->sprites_.size();
+    this->stats_.bytesPerQuad =
+        sizeof(SpriteBatch::Sprite) + sizeof(uint64_t) + sizeof(const Image*) + sizeof(SpriteBatch::Vertex) * 4;
+    this->stats_.prepareMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void
+Renderer::drawSprites(uint8_t first, uint8_t last)
+{
+    if (this->sprites_.size() == 0 || first > last) {
+        return;
+    }
+    this->shaders_.sprite.attach();
+    // see bind_image
+    glUniform1i(this->uniforms_.sprite.uTexture.location, 0);
+    glUniform1i(this->uniforms_.sprite.uTextureArray.location, 1);
+    glUniform1i(this->uniforms_.sprite.uIndices.location, 2);
+    glUniform1i(this->uniforms_.sprite.uIndexArray.location, 3);
+    glUniform1i(this->uniforms_.sprite.uPalette.location, 4);
+    this->stats_.drawCalls += this->sprites_.draw(
+        [this](const Image& image) {
+            bind_image(image, this->uniforms_.sprite.uArray, this->uniforms_.sprite.uIndexed);
+            this->stats_.textureSwitches++;
+        },
+        first,
+        last);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void
+Renderer::drawLines()
+{
+    this->shaders_.line.attach();
+
+    // one draw call per page, segments never straddle pages
+    auto& batch = this->meshes_.line.batch;
+    batch.flush();
+    glBindVertexArray(this->meshes_.line.vao);
+    for (size_t page = 0; page < batch.pages(); ++page) {
+        auto count = batch.size(page) / sizeof(Segment);
+        glBindVertexBuffer(0, batch.handle(page), batch.offset(), sizeof(Segment));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+        this->stats_.segments += count;
+    }
+    glBindVertexArray(NULL);
+    batch.clear();
+}
+
+void
+Renderer::drawScene(uint8_t first, uint8_t last)
+{
+    for (auto layer : this->sceneLayers_) {
+        if (layer >= first && layer <= last) {
+            this->drawSceneLayer(layer);
+        }
+    }
+}
+
+void
+Renderer::drawSceneLayer(uint8_t layer)
+{
+    // opaque quads go first, front-to-back, so that nothing behind them is drawn at all
+    bool opaque = this->opaquePass_ && std::any_of(this->commands_.quad_tex.begin(),
+                                           this->commands_.quad_tex.end(),
+                                           [layer](const TexturedQuadCommand& command) {
+                                               return command.opaque && command.layer == layer;
+                                           });
+    if (opaque) {
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        // later quads of the same command are drawn over earlier ones
+        glDepthFunc(GL_LEQUAL);
+        glDisable(GL_BLEND);
+        this->beginSampleQuery(true);
+        this->drawTexturedQuads(this->commands_.quad_tex, nullptr, QuadPass::Opaque, layer);
+        this->endSampleQuery();
+        // everything else is tested against them, but behind them
+        glEnable(GL_BLEND);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LESS);
+    }
+
+    // render tile layers
+    if (!this->commands_.tile_layers.empty()) {
+        this->shaders_.tile_layer.attach();
+        glUniform1i(this->uniforms_.tile_layer.uTiles.location, 0);
+        glUniform1i(this->uniforms_.tile_layer.uPages.location, 1);
+        glUniform1i(this->uniforms_.tile_layer.uIndexPages.location, 3);
+        glUniform1i(this->uniforms_.tile_layer.uPalette.location, 4);
+        glUniform1i(this->uniforms_.tile_layer.uAnimations.location, 5);
+        glUniform1i(this->uniforms_.tile_layer.uAnimatedTiles.location, 6);
+        glUniform1i(this->uniforms_.tile_layer.uPageTable.location, 7);
+        glUniform1ui(this->uniforms_.tile_layer.uTime.location, (GLuint)this->time().count());
+        glBindVertexArray(this->meshes_.fullscreen.vao);
+
+        for (const auto& tiles : this->commands_.tile_layers) {
+            if (tiles.layer != layer)
+                continue;
+            tiles.tiles->attach(GL_TEXTURE0);
+            bind_pages(*tiles.tilesets,
+                GL_TEXTURE1,
+                GL_TEXTURE3,
+                this->uniforms_.tile_layer.uIndexed,
+                this->uniforms_.tile_layer.uPagedSize,
+                this->uniforms_.tile_layer.uSlotsPerRow,
+                this->uniforms_.tile_layer.uPageLevels);
+            if (tiles.animatedTiles != nullptr) {
+                tiles.animations->attach(GL_TEXTURE5);
+                tiles.animatedTiles->attach(GL_TEXTURE6);
+            }
+            glUniform1i(this->uniforms_.tile_layer.uAnimated.location, tiles.animatedTiles != nullptr);
+            glUniform2fv(this->uniforms_.tile_layer.uOrigin.location, 1, glm::value_ptr(tiles.origin));
+            glUniform1f(this->uniforms_.tile_layer.uTileSize.location, tiles.tileSize);
+            glUniform1iv(this->uniforms_.tile_layer.uTilesPerRow.location,
+                (GLsizei)tiles.tilesPerRow.size(),
+                tiles.tilesPerRow.data());
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+    // render textured quads
+    auto& commands = this->commands_.quad_tex;
+    if (!opaque) {
+        this->beginSampleQuery(false);
+        this->drawTexturedQuads(commands, nullptr, QuadPass::All, layer);
+        this->endSampleQuery();
+    } else {
+        this->beginSampleQuery(false);
+        this->drawTexturedQuads(commands, nullptr, QuadPass::Blended, layer);
+        this->endSampleQuery();
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+    }
+
+    // render grids
+    if (!this->commands_.grids.empty()) {
+        this->shaders_.grid.attach();
+        glUniform4fv(this->uniforms_.grid.uColor.location, 1, glm::value_ptr(this->lineColor_));
+        glBindVertexArray(this->meshes_.fullscreen.vao);
+
+        for (const auto& grid : this->commands_.grids) {
+            if (grid.layer != layer)
+                continue;
+            glUniform2fv(this->uniforms_.grid.uOrigin.location, 1, glm::value_ptr(grid.origin));
+            glUniform2fv(this->uniforms_.grid.uSize.location, 1, glm::value_ptr(grid.size));
+            glUniform1f(this->uniforms_.grid.uCellSize.location, grid.cellSize);
+            glUniform1f(this->uniforms_.grid.uThickness.location, grid.thickness);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    }
+}
+
+void
+Renderer::beginSampleQuery(bool opaque)
+{
+    if (this->sampleQueries_.free.empty()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        this->sampleQueries_.free.push_back(query);
+    }
+    auto query = this->sampleQueries_.free.back();
+    this->sampleQueries_.free.pop_back();
+    this->sampleQueries_.pending.back().push_back({ query, opaque });
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+}
+
+void
+Renderer::endSampleQuery()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void
+Renderer::renderCachedScene(const glm::mat4& projection, const glm::mat4& view, uint8_t last)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int width = viewport[2];
+    int height = viewport[3];
+
+    auto& cache = this->sceneCache_;
+    if (cache.front == nullptr || cache.front->width() != width || cache.front->height() != height) {
+        cache.front = std::make_unique<Framebuffer>(width, height, true);
+        cache.back = std::make_unique<Framebuffer>(width, height, true);
+        cache.valid = false;
+    }
+
+    // how many pixels the scene moved since it was cached, a full redraw is needed unless it's a whole number
+    // sprites coming and going only matter if that changes which layers the cache holds
+    auto held = std::upper_bound(this->sceneLayers_.begin(), this->sceneLayers_.end(), last);
+    int highest = held == this->sceneLayers_.begin() ? -1 : *std::prev(held);
+    bool redraw = !cache.valid || cache.projection != projection || cache.highest != highest;
+    glm::ivec2 shift = { 0, 0 };
+    if (!redraw && cache.view != view) {
+        glm::vec4 before = projection * cache.view * glm::vec4(0.f, 0.f, 0.f, 1.f);
+        glm::vec4 after = projection * view * glm::vec4(0.f, 0.f, 0.f, 1.f);
+        glm::vec2 pixels = glm::vec2(after - before) / 2.f * glm::vec2(width, height);
+        shift = glm::round(pixels);
+        auto error = glm::abs(pixels - glm::vec2(shift));
+        redraw = std::max(error.x, error.y) > SCENE_SHIFT_TOLERANCE || std::abs(shift.x) >= width ||
+                 std::abs(shift.y) >= height;
+    }
+
+    if (redraw) {
+        cache.front->bind();
+        glClear(GL_COLOR_BUFFER_BIT);
+        this->drawScene(0, last);
+    } else if (shift != glm::ivec2(0, 0)) {
+        // move the part which is still visible, the framebuffers are swapped as a blit can't overlap itself
+        glm::ivec2 from = glm::max(-shift, glm::ivec2(0));
+        glm::ivec2 to = glm::min(glm::ivec2(width, height) - shift, glm::ivec2(width, height));
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, cache.front->handle());
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.back->handle());
+        glBlitFramebuffer(from.x,
+            from.y,
+            to.x,
+            to.y,
+            from.x + shift.x,
+            from.y + shift.y,
+            to.x + shift.x,
+            to.y + shift.y,
+            GL_COLOR_BUFFER_BIT,
+            GL_NEAREST);
+        std::swap(cache.front, cache.back);
+
+        // then only draw the strips which were exposed
+        cache.front->bind();
+        glEnable(GL_SCISSOR_TEST);
+        if (shift.x != 0) {
+            glScissor(shift.x > 0 ? 0 : width + shift.x, 0, std::abs(shift.x), height);
+            glClear(GL_COLOR_BUFFER_BIT);
+            this->drawScene(0, last);
+        }
+        if (shift.y != 0) {
+            glScissor(0, shift.y > 0 ? 0 : height + shift.y, width, std::abs(shift.y));
+            glClear(GL_COLOR_BUFFER_BIT);
+            this->drawScene(0, last);
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+    cache.front->unbind();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    cache.projection = projection;
+    cache.view = view;
+    cache.highest = highest;
+    cache.valid = true;
+
+    // the default framebuffer is multisampled, so the cache is drawn instead of blitted
+    glDisable(GL_BLEND);
+    this->shaders_.composite.attach();
+    glUniform1i(this->uniforms_.composite.uScene.location, 0);
+    cache.front->color().attach(GL_TEXTURE0);
+    glBindVertexArray(this->meshes_.fullscreen.vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_BLEND);
 }
 
 void
 Renderer::setLineColor(glm::vec4 color)
 {
+    // grids are part of the scene
+    if (color != this->lineColor_) {
+        this->invalidateScene();
+    }
     this->lineColor_ = color;
 }
 
+void
+Renderer::setPersistentBuffers(bool enabled)
+{
+    this->sprites_.persistent(enabled);
+    this->meshes_.line.batch.persistent(enabled);
+}
+
+void
+Renderer::setSceneCache(bool enabled)
+{
+    this->sceneCache_.enabled = enabled;
+    if (!enabled) {
+        this->sceneCache_.valid = false;
+    }
+}
+
+void
+Renderer::setOpaquePass(bool enabled)
+{
+    if (enabled != this->opaquePass_) {
+        this->invalidateScene();
+    }
+    this->opaquePass_ = enabled;
+}
+
+void
+Renderer::setUploadBudget(std::chrono::microseconds budget)
+{
+    this->uploadBudget_ = budget;
+}
+
+void
+Renderer::invalidateScene()
+{
+    this->sceneCache_.valid = false;
+}
+
+std::chrono::milliseconds
+Renderer::time()
+{
+    if (!this->frameTime_) {
+        this->frameTime_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - this->epoch_);
+    }
+    return *this->frameTime_;
+}
+
+void
+Renderer::renderTo(Framebuffer& target,
+    glm::vec4 area,
+    const InstanceBuffer& instances,
+    const std::vector<TexturedQuadCommand>& commands)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    target.bind();
+    // quads are copied as they are, so that the target can later be blended like the quads themselves
+    glDisable(GL_BLEND);
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    auto projection = glm::ortho(area.x, area.z, area.y, area.w, -1.f, 1.f);
+    this->setCamera(projection, glm::mat4(1), { target.width(), target.height() });
+    this->drawTexturedQuads(commands, &instances);
+
+    target.unbind();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glEnable(GL_BLEND);
+}
+
+void
+Renderer::drawTexturedQuads(const std::vector<TexturedQuadCommand>& commands,
+    const InstanceBuffer* instances,
+    QuadPass pass,
+    std::optional<uint8_t> layer)
+{
+    this->shaders_.quad_tex.attach();
+    // see bind_image
+    glUniform1i(this->uniforms_.quad_tex.uTexture.location, 0);
+    glUniform1i(this->uniforms_.quad_tex.uTextureArray.location, 1);
+    glUniform1i(this->uniforms_.quad_tex.uIndices.location, 2);
+    glUniform1i(this->uniforms_.quad_tex.uIndexArray.location, 3);
+    glUniform1i(this->uniforms_.quad_tex.uPalette.location, 4);
+    glUniform1i(this->uniforms_.quad_tex.uAnimations.location, 5);
+    glUniform1i(this->uniforms_.quad_tex.uPageTable.location, 7);
+    glUniform1i(this->uniforms_.quad_tex.uAnimated.location, false);
+    glUniform1i(this->uniforms_.quad_tex.uPaged.location, false);
+    glUniform1ui(this->uniforms_.quad_tex.uTime.location, (GLuint)this->time().count());
+    this->meshes_.quad_tex.attach();
+
+    const InstanceBuffer* lastBuffer = nullptr;
+    GLuint lastTexture = 0;
+    const Image* lastAnimations = nullptr;
+    glUniform1f(this->uniforms_.quad_tex.uDepth.location, 0.f);
+    for (size_t i = 0; i < commands.size(); ++i) {
+        // opaque commands are drawn in reverse
+        auto index = pass == QuadPass::Opaque ? commands.size() - 1 - i : i;
+        const auto& command = commands[index];
+        if (layer && command.layer != *layer)
+            continue;
+        if (pass != QuadPass::All) {
+            if (command.opaque != (pass == QuadPass::Opaque))
+                continue;
+            // in front of full-screen passes at 0, later commands closer to the camera at -1
+            glUniform1f(this->uniforms_.quad_tex.uDepth.location, -(float)(index + 1) / (commands.size() + 1));
+        }
+        const InstanceBuffer* buffer = command.instances != nullptr ? command.instances : instances;
+        if (buffer != lastBuffer) {
+            lastBuffer = buffer;
+            this->meshes_.quad_tex.bindInstances(buffer->handle());
+        }
+        // only switch textures when they actually change, array images and pages are shared by many commands
+        if (command.pages != nullptr) {
+            if (command.pages->pages().handle() != lastTexture) {
+                lastTexture = command.pages->pages().handle();
+                bind_pages(*command.pages,
+                    GL_TEXTURE0,
+                    GL_TEXTURE2,
+                    this->uniforms_.quad_tex.uIndexed,
+                    this->uniforms_.quad_tex.uPagedSize,
+                    this->uniforms_.quad_tex.uSlotsPerRow,
+                    this->uniforms_.quad_tex.uPageLevels);
+                glUniform1i(this->uniforms_.quad_tex.uPaged.location, true);
+                this->stats_.textureSwitches++;
+            }
+        } else {
+            auto* image = this->resolve(command.image);
+            if (image->handle() != lastTexture) {
+                lastTexture = image->handle();
+                bind_image(*image, this->uniforms_.quad_tex.uArray, this->uniforms_.quad_tex.uIndexed);
+                glUniform1i(this->uniforms_.quad_tex.uPaged.location, false);
+                this->stats_.textureSwitches++;
+            }
+        }
+        if (command.animations != lastAnimations) {
+            lastAnimations = command.animations;
+            if (lastAnimations != nullptr) {
+                lastAnimations->attach(GL_TEXTURE5);
+            }
+            glUniform1i(this->uniforms_.quad_tex.uAnimated.location, lastAnimations != nullptr);
+        }
+        this->meshes_.quad_tex.draw(GL_TRIANGLES, command.count, command.first);
+        this->stats_.drawCalls++;
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+const Image*
+Renderer::resolve(const Image* image) const
+{
+    return image == nullptr || image->ready() ? image : &this->placeholder_;
+}
+
+const Renderer::Stats&
+Renderer::stats() const
+{
+    return this->stats_;
+}
+
 } // namespace gfx
\ No newline at end of file
@@ -4,78 +4,339 @@
 
 #include "gfx/gl.h"
 #include "gfx/shader.hpp"
+#include "gfx/shader_cache.hpp"
 #include "gfx/mesh.hpp"
 #include "gfx/batch.hpp"
+#include "gfx/sprite_batch.hpp"
+#include "gfx/instance.hpp"
+#include "gfx/uniform_buffer.hpp"
+#include "gfx/framebuffer.hpp"
 
 namespace gfx {
 
 class Camera;
 class Image;
+class PageCache;
 
 class Renderer final
 {
 public:
+    /**
+     * Per-instance data of a textured quad.
+     * `layer` selects the layer when the quad is drawn from an array image, and is ignored otherwise.
+     * `animation` is 0, or 1 + the row of the command's animation table, whose current frame then replaces
+     * the offset of `uv`.
+     */
+    struct QuadInstance
+    {
+        glm::vec2 position;
+        glm::vec2 scale;
+        glm::vec4 uv;
+        float layer;
+        float animation;
+    }; // struct QuadInstance
+
+    /**
+     * Consecutive textured quads which share a texture, drawn with a single instanced draw call.
+     * `image` may be a GL_TEXTURE_2D_ARRAY, in which case each quad samples from its own layer.
+     * `instances` is the buffer holding the quads, or `nullptr` for the buffer passed to Renderer::renderTo.
+     * `opaque` quads have no transparent pixels at all, they are drawn front-to-back, without blending,
+     * and hide whatever is behind them from the depth test.
+     * `animations` is the GL_RGBA32F animation table of the quads, laid out as described in animation.glsl.
+     * If `pages` is set, quads sample that paged image instead of `image`, each from its own layer.
+     * Its pages have to be resident until the command is drawn, see PageCache::require.
+     * `layer` is the scene layer it's drawn in, see Renderer::render.
+     */
     struct TexturedQuadCommand
     {
         const Image* image;
-        glm::vec4 uv;
-        glm::mat4 model;
-    }; // struct ImageCommand
+        const InstanceBuffer* instances;
+        uint32_t first;
+        uint32_t count;
+        bool opaque = false;
+        const Image* animations = nullptr;
+        const PageCache* pages = nullptr;
+        uint8_t layer = 0;
+    }; // struct TexturedQuadCommand
+
+    /**
+     * A line segment from `start` to `end` in world space, `width` pixels wide at any zoom.
+     * `color` is RGBA with 8 bits per channel, red in the lowest byte.
+     */
+    struct Segment
+    {
+        glm::vec2 start;
+        glm::vec2 end;
+        uint32_t color;
+        float width;
+    }; // struct Segment
+
+    /**
+     * A grid of square cells covering `size` world units from `origin`, drawn analytically in a single pass.
+     */
+    struct GridCommand
+    {
+        glm::vec2 origin;
+        glm::vec2 size;
+        float cellSize;
+        // line width in pixels, independent of zoom
+        float thickness;
+        uint8_t layer = 0;
+    }; // struct GridCommand
 
-    struct ColoredQuadCommand
+    /**
+     * A whole tile map drawn with a single full-screen pass, looking up every pixel's tile in `tiles`.
+     * `tiles` is a GL_R16UI image holding one tile::Tile per texel, `tilesets` a paged image with the atlas
+     * of each tileset in the layer matching its id, starting in the bottom left corner. Pages of visible tiles
+     * have to be resident until the command is drawn.
+     * If tiles are animated, `animatedTiles` is a GL_R16UI image with a row per tileset and a texel per tile id,
+     * holding 0 or 1 + the tile's row in the `animations` table, see TexturedQuadCommand::animations.
+     */
+    struct TileLayerCommand
+    {
+        const Image* tiles;
+        const PageCache* tilesets;
+        glm::vec2 origin;
+        float tileSize;
+        // tiles per atlas row of each tileset, 0 for layers without a tileset
+        std::array<int, 1 << 6> tilesPerRow;
+        const Image* animations = nullptr;
+        const Image* animatedTiles = nullptr;
+        uint8_t layer = 0;
+    }; // struct TileLayerCommand
+
+    /**
+     * Statistics of the last Renderer::render.
+     */
+    struct Stats
     {
-        glm::vec4 color;
-        glm::mat4 model;
-    }; // struct ColoredQuadCommand
+        // sprites submitted one by one, and the memory each of them takes up until it's drawn
+        size_t quads;
+        size_t bytesPerQuad;
+        // time spent sorting them and generating their vertices
+        double prepareMilliseconds;
+        // textured quad and sprite draw calls, and how many of them had to bind a different texture
+        size_t drawCalls;
+        size_t textureSwitches;
+        // line segments
+        size_t segments;
+        // samples of textured quads written with and without blending, as of the latest frame the GPU finished
+        uint64_t blendedSamples;
+        uint64_t opaqueSamples;
+        // images still loading, see Image::Load, and time spent uploading their pixels
+        size_t pendingImages;
+        double uploadMilliseconds;
+    }; // struct Stats
 
-    Renderer();
+    /**
+     * Uniform buffer binding point of the Camera block, which all programs share.
+     */
+    static const GLuint CAMERA_BINDING = 0;
+    /**
+     * Default time per frame spent uploading images, see Renderer::setUploadBudget.
+     */
+    static constexpr std::chrono::microseconds DEFAULT_UPLOAD_BUDGET = std::chrono::milliseconds(4);
+
+    /**
+     * @param resources directory containing the `shaders` directory, program binaries are cached in `shader_cache`
+     */
+    explicit Renderer(const std::string& resources = ".");
     ~Renderer() = default;
 
     // TODO: this should be camera, not window
     /**
-     * Submits a textured quad draw command.
+     * Submits a textured quad draw command. `model` may be any 2D affine transform.
+     *
+     * Textured and colored quads submitted one by one are sprites: they are drawn in submission order by a single
+     * SpriteBatch, after the scene layers up to their own, see Renderer::render.
      */
     void submit(const Image* image, glm::vec4 uv = { 0.0f, 0.0f, 1.0f, 1.0f }, glm::mat4 model = glm::mat4(1));
+    /**
+     * Submits a textured quad centered at `position`, extending `scale` in each direction.
+     * Sprites on lower layers are always drawn first, within a layer they keep their submission order.
+     */
+    void submit(const Image* image, glm::vec2 position, glm::vec2 scale, glm::vec4 uv, uint8_t layer = 0);
+    /**
+     * Submits textured quads which are already uploaded to `instances`.
+     * Each command draws a range of QuadInstance records from `instances`, which must outlive the next Renderer::render.
+     */
+    void submit(const InstanceBuffer& instances, const std::vector<TexturedQuadCommand>& commands);
     /**
      * Submits a colored quad draw command.
      */
     void submit(glm::vec4 color, glm::mat4 model = glm::mat4(1));
     /**
-     * Submits a line draw command. Start/end coordinates have to be in world space.
+     * Submits a line draw command in the line color. Start/end coordinates have to be in world space.
+     * @param thickness width in pixels, independent of zoom
      */
     void submit(glm::vec2 start, glm::vec2 end, float thickness = 1.0f);
+    /**
+     * Submits a line draw command. Lines are expanded on the GPU, and drawn on top of sprites in a single
+     * instanced draw call per Batch page.
+     * @param width in pixels, independent of zoom
+     */
+    void submit(glm::vec2 start, glm::vec2 end, glm::vec4 color, float width);
+    /**
+     * Submits a grid draw command. Grids use the line color.
+     */
+    void submit(const GridCommand& grid);
+    /**
+     * Submits a tile layer draw command. Tile layers are drawn before anything else in their scene layer.
+     */
+    void submit(const TileLayerCommand& layer);
     /**
      * Render primitives from POV of `camera`.
+     * Tile layers, textured quads in instance buffers and grids make up the scene, in layers drawn from the lowest.
+     * Within a layer, tile layers are drawn first, then quads, then grids, then the sprites on that layer, so
+     * sprites can sit between layers of a map. Lines are drawn on top of everything.
      */
     void render(Camera& camera);
+    /**
+     * Immediately render `commands` into `target`, which is cleared first. Pending submissions are not affected.
+     * Quads overwrite the target instead of blending with it, so the result can later be drawn like the quads were.
+     * @param area world space rectangle mapped onto the target, as { left, bottom, right, top }
+     */
+    void renderTo(Framebuffer& target,
+        glm::vec4 area,
+        const InstanceBuffer& instances,
+        const std::vector<TexturedQuadCommand>& commands);
 
     void setLineColor(glm::vec4 color);
+    /**
+     * Stream sprite vertices and line segments through persistently mapped buffers,
+     * or fall back to glBufferSubData uploads.
+     */
+    void setPersistentBuffers(bool enabled);
+    /**
+     * Keep the rendered scene in an offscreen image, and reuse it while the camera doesn't change.
+     * When the camera is panned by whole pixels, the image is shifted and only the exposed strips are drawn.
+     * Submitted scene commands are ignored while the cache is reused, so changes to the scene have to be signaled
+     * with Renderer::invalidateScene. Sprites and lines are always drawn. Only scene layers up to the lowest sprite
+     * layer are cached, those above it are drawn every frame.
+     */
+    void setSceneCache(bool enabled);
+    /**
+     * Draw opaque textured quads in a separate front-to-back pass, see TexturedQuadCommand::opaque.
+     * Otherwise they are blended in order like all other quads, which is the default.
+     */
+    void setOpaquePass(bool enabled);
+    /**
+     * Time per frame spent copying pixels of images loaded with Image::Load into their textures.
+     * Images which aren't ready yet are drawn as a grey placeholder.
+     */
+    void setUploadBudget(std::chrono::microseconds budget);
+    /**
+     * Redraw the whole scene in the next Renderer::render.
+     */
+    void invalidateScene();
+    /**
+     * Time animations are drawn at, since the renderer was created.
+     * It's fixed from the first call in a frame until the end of the next Renderer::render, so that anything
+     * deciding what to draw based on it sees the same time as the GPU.
+     */
+    std::chrono::milliseconds time();
+    /**
+     * Reload programs whose shader files changed, see Shader::reload. Renderer::render checks every so often on its
+     * own, a loop which only redraws on input also has to call this while it waits.
+     * @return whether any program was reloaded, the scene then has to be drawn again
+     */
+    bool reloadShaders();
+
+    const Stats& stats() const;
 
 private:
+    enum class QuadPass
+    {
+        // all commands, in order, at the same depth
+        All,
+        // only opaque commands, front-to-back, each at its own depth
+        Opaque,
+        // only the other commands, in order, each at its own depth
+        Blended
+    }; // enum class QuadPass
+
+    /**
+     * Camera uniform block, laid out according to std140.
+     */
+    struct CameraBlock
+    {
+        glm::mat4 projection;
+        glm::mat4 view;
+        glm::mat4 inverseViewProjection;
+        glm::vec2 viewport;
+        glm::vec2 padding;
+    }; // struct CameraBlock
+
+    Shader loadShader(const std::string& vertex, const std::string& fragment) const;
+    // `image`, or the placeholder while it's loading
+    const Image* resolve(const Image* image) const;
+    // look up the uniforms of all programs, their locations change when a program is reloaded
+    void gatherUniforms();
+    // upload the camera uniform block, if it changed
+    void setCamera(const glm::mat4& projection, const glm::mat4& view, glm::vec2 viewport);
+    /**
+     * Draw the scene layers from `first` to `last`, see Renderer::render.
+     */
+    void drawScene(uint8_t first, uint8_t last);
+    void drawSceneLayer(uint8_t layer);
+    /**
+     * Draw the scene layers up to `last` into the scene cache, unless it already holds them, then draw the cache.
+     */
+    void renderCachedScene(const glm::mat4& projection, const glm::mat4& view, uint8_t last);
+    void prepareSprites();
+    /**
+     * Draw the prepared sprites on layers from `first` to `last`.
+     */
+    void drawSprites(uint8_t first, uint8_t last);
+    void drawLines();
+    /**
+     * @param instances buffer of the commands which don't have their own
+     */
+    void drawTexturedQuads(const std::vector<TexturedQuadCommand>& commands,
+        const InstanceBuffer* instances = nullptr,
+        QuadPass pass = QuadPass::All,
+        std::optional<uint8_t> layer = std::nullopt);
+    // count samples passed by the following draws into Stats::blendedSamples or Stats::opaqueSamples
+    void beginSampleQuery(bool opaque);
+    void endSampleQuery();
+
+    fs::path shaderDirectory_;
+    ShaderCache shaderCache_;
     struct Shaders
     {
         Shader quad_tex;
-        Shader quad_col;
+        Shader sprite;
         Shader line;
+        Shader grid;
+        Shader tile_layer;
+        Shader composite;
     } shaders_;
 
     struct Meshes
     {
         Mesh quad_tex;
-        Mesh quad_col;
+        // one Segment per instance, the vertex buffer is bound per batch page
         struct
         {
             Batch batch;
             GLuint vao;
         } line;
+        // full-screen passes generate their vertices in the vertex shader, this has no attributes
+        struct
+        {
+            GLuint vao;
+        } fullscreen;
     } meshes_;
 
+    // textured and colored quads submitted one by one
+    SpriteBatch sprites_;
+
     // draw command buffers
     struct CommandBuffers
     {
         std::vector<TexturedQuadCommand> quad_tex;
-        std::vector<ColoredQuadCommand> quad_col;
-        size_t lines;
+        std::vector<GridCommand> grids;
+        std::vector<TileLayerCommand> tile_layers;
     } commands_;
 
     // uniforms
@@ -83,28 +344,107 @@ private:
     {
         struct
         {
-            Uniform uProj;
-            Uniform uView;
-            Uniform uModel;
-            Uniform uUV;
             Uniform uTexture;
+            Uniform uTextureArray;
+            Uniform uIndices;
+            Uniform uIndexArray;
+            Uniform uPalette;
+            Uniform uArray;
+            Uniform uIndexed;
+            Uniform uPaged;
+            Uniform uPageTable;
+            Uniform uPagedSize;
+            Uniform uSlotsPerRow;
+            Uniform uPageLevels;
+            Uniform uAnimations;
+            Uniform uAnimated;
+            Uniform uTime;
+            Uniform uDepth;
         } quad_tex;
         struct
         {
-            Uniform uProj;
-            Uniform uView;
-            Uniform uModel;
-            Uniform uColor;
-        } quad_col;
+            Uniform uTexture;
+            Uniform uTextureArray;
+            Uniform uIndices;
+            Uniform uIndexArray;
+            Uniform uPalette;
+            Uniform uArray;
+            Uniform uIndexed;
+        } sprite;
         struct
         {
-            Uniform uProj;
-            Uniform uView;
             Uniform uColor;
-        } line;
+            Uniform uOrigin;
+            Uniform uSize;
+            Uniform uCellSize;
+            Uniform uThickness;
+        } grid;
+        struct
+        {
+            Uniform uTiles;
+            Uniform uPages;
+            Uniform uIndexPages;
+            Uniform uPalette;
+            Uniform uIndexed;
+            Uniform uPageTable;
+            Uniform uPagedSize;
+            Uniform uSlotsPerRow;
+            Uniform uPageLevels;
+            Uniform uAnimations;
+            Uniform uAnimatedTiles;
+            Uniform uAnimated;
+            Uniform uTime;
+            Uniform uOrigin;
+            Uniform uTileSize;
+            Uniform uTilesPerRow;
+        } tile_layer;
+        struct
+        {
+            Uniform uScene;
+        } composite;
     } uniforms_;
 
+    // per-frame camera data, bound to CAMERA_BINDING
+    UniformBuffer camera_;
+    CameraBlock cameraBlock_;
     glm::vec4 lineColor_;
+    // drawn instead of images which are still loading
+    Image placeholder_;
+    std::chrono::microseconds uploadBudget_;
+    Stats stats_;
+    bool opaquePass_;
+
+    // GL_SAMPLES_PASSED queries, results are only read once they're available, so that stats never stall rendering
+    struct SampleQueries
+    {
+        std::vector<GLuint> free;
+        // per frame, oldest first: query, and whether it counted opaque samples
+        std::list<std::vector<std::pair<GLuint, bool>>> pending;
+        // samples counted by the latest frame whose queries are all available
+        uint64_t blended;
+        uint64_t opaque;
+    } sampleQueries_;
+
+    // the scene as it was last rendered, from `projection` and `view`
+    struct SceneCache
+    {
+        bool enabled = false;
+        bool valid = false;
+        std::unique_ptr<Framebuffer> front;
+        std::unique_ptr<Framebuffer> back;
+        glm::mat4 projection;
+        glm::mat4 view;
+        // the highest scene layer it holds, or -1 if none
+        int highest = -1;
+    } sceneCache_;
+    // scene layers which have any commands this frame, in ascending order
+    std::vector<uint8_t> sceneLayers_;
+
+    // when shader files were last checked for changes
+    std::chrono::steady_clock::time_point lastShaderCheck_;
+    // animation time is measured from here, and fixed for the frame being rendered once it's read
+    std::chrono::steady_clock::time_point epoch_;
+    std::optional<std::chrono::milliseconds> frameTime_;
 }; // class Renderer
 
 } // namespace gfx
@@ -1,33 +1,77 @@
 
 #include "pch.h"
 #include "shader.hpp"
+#include "shader_cache.hpp"
 
 namespace gfx {
 
-void
-checkShader(GLuint handle)
+// includes nested deeper than this are assumed to be recursive
+static const int MAX_INCLUDE_DEPTH = 16;
+
+GLuint
+compileShader(GLenum type, const std::string& source)
 {
+    GLuint handle = glCreateShader(type);
+    const char* source_c = source.c_str();
+    glShaderSource(handle, 1, &source_c, NULL);
+    glCompileShader(handle);
+
     int success;
     glGetShaderiv(handle, GL_COMPILE_STATUS, &success);
     if (!success) {
         char infoLog[512];
         glGetShaderInfoLog(handle, 512, NULL, infoLog);
-        spdlog::error("Shader compilation failed:\n{}", infoLog);
-        abort();
+        glDeleteShader(handle);
+        throw std::runtime_error(fmt::format("Shader compilation failed:\n{}", infoLog));
     };
+    return handle;
 }
 
-void
-checkProgram(GLuint handle)
+GLuint
+linkProgram(const std::string& vsrc, const std::string& fsrc, const ShaderCache* cache)
 {
+    if (cache != nullptr) {
+        if (auto handle = cache->load(vsrc, fsrc); handle != 0) {
+            return handle;
+        }
+    }
+
+    // compile vertex & fragment stages
+    GLuint vertex = compileShader(GL_VERTEX_SHADER, vsrc);
+    GLuint fragment;
+    try {
+        fragment = compileShader(GL_FRAGMENT_SHADER, fsrc);
+    } catch (...) {
+        glDeleteShader(vertex);
+        throw;
+    }
+    // link program
+    GLuint handle = glCreateProgram();
+    if (cache != nullptr && cache->supported()) {
+        glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(handle, vertex);
+    glAttachShader(handle, fragment);
+    glLinkProgram(handle);
+    // discard intermediates
+    glDetachShader(handle, vertex);
+    glDetachShader(handle, fragment);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
     int success;
-    glGetProgramiv(handle, GL_COMPILE_STATUS, &success);
+    glGetProgramiv(handle, GL_LINK_STATUS, &success);
     if (!success) {
         char infoLog[512];
         glGetProgramInfoLog(handle, 512, NULL, infoLog);
-        spdlog::error("Program linking failed:\n{}", infoLog);
-        abort();
+        glDeleteProgram(handle);
+        throw std::runtime_error(fmt::format("Program linking failed:\n{}", infoLog));
     };
+
+    if (cache != nullptr) {
+        cache->store(vsrc, fsrc, handle);
+    }
+    return handle;
 }
 
 void
@@ -47,6 +91,9 @@ queryUniforms(GLuint handle, std::unordered_map<std::string, Uniform>& uniforms)
 
         std::string name(buffer.begin(), buffer.begin() + length);
         int location = glGetUniformLocation(handle, name.c_str());
+        // members of uniform blocks are sourced from buffers, see queryUniformBlocks
+        if (location < 0)
+            continue;
 
         uniforms.emplace(name, Uniform{ name, type, location, size, length });
     }
@@ -54,33 +101,34 @@ queryUniforms(GLuint handle, std::unordered_map<std::string, Uniform>& uniforms)
     glUseProgram(NULL);
 }
 
-Shader::Shader(const std::string& vsrc, const std::string& fsrc)
-  : handle_(0)
-  , uniforms_()
+void
+queryUniformBlocks(GLuint handle, std::unordered_map<std::string, UniformBlock>& blocks)
 {
+    int count;
+    glGetProgramiv(handle, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (int i = 0; i < count; ++i) {
+        int length, size, binding;
+        std::array<char, 64> buffer;
+        glGetActiveUniformBlockName(handle, i, 64, &length, buffer.data());
+        if (length == 0)
+            continue;
+        glGetActiveUniformBlockiv(handle, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        glGetActiveUniformBlockiv(handle, i, GL_UNIFORM_BLOCK_BINDING, &binding);
 
-    GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    // compile vertex & fragment stages
-    const char* vsrc_c = vsrc.c_str();
-    const char* fsrc_c = fsrc.c_str();
-    glShaderSource(vertex, 1, &vsrc_c, NULL);
-    glShaderSource(fragment, 1, &fsrc_c, NULL);
-    glCompileShader(vertex);
-    glCompileShader(fragment);
-    checkShader(vertex);
-    checkShader(fragment);
-    // link program
-    this->handle_ = glCreateProgram();
-    glAttachShader(this->handle_, vertex);
-    glAttachShader(this->handle_, fragment);
-    glLinkProgram(this->handle_);
-    checkProgram(this->handle_);
-    // discard intermediates
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+        std::string name(buffer.begin(), buffer.begin() + length);
+        blocks.emplace(name, UniformBlock{ name, (GLuint)i, size, (GLuint)binding });
+    }
+}
 
-    queryUniforms(this->handle_, this->uniforms_);
+Shader::Shader(const std::string& vsrc, const std::string& fsrc, const ShaderCache* cache)
+  : handle_(0)
+  , uniforms_()
+  , uniformBlocks_()
+  , cache_(cache)
+  , paths_()
+  , files_()
+{
+    this->assign(linkProgram(vsrc, fsrc, cache));
 }
 
 Shader::~Shader()
@@ -91,18 +139,120 @@ Shader::~Shader()
 Shader::Shader(Shader&& other)
   : handle_(std::exchange(other.handle_, 0))
   , uniforms_(std::move(other.uniforms_))
+  , uniformBlocks_(std::move(other.uniformBlocks_))
+  , cache_(other.cache_)
+  , paths_(std::move(other.paths_))
+  , files_(std::move(other.files_))
 {}
 
 Shader&
 Shader::operator=(Shader&& other)
 {
     if (this != &other) {
+        glDeleteProgram(this->handle_);
         this->handle_ = std::exchange(other.handle_, 0);
         this->uniforms_ = std::move(other.uniforms_);
+        this->uniformBlocks_ = std::move(other.uniformBlocks_);
+        this->cache_ = other.cache_;
+        this->paths_ = std::move(other.paths_);
+        this->files_ = std::move(other.files_);
     }
     return *this;
 }
 
+std::string
+Shader::Preprocess(const fs::path& path, std::vector<File>& files, int depth)
+{
+    if (depth > MAX_INCLUDE_DEPTH) {
+        throw std::runtime_error(fmt::format("Includes nested too deeply in {}", path.generic_string()));
+    }
+    // the time is taken first, so that a change while reading is picked up by the next Shader::reload
+    std::error_code error;
+    auto time = fs::last_write_time(path, error);
+    std::ifstream file(path);
+    if (error || !file) {
+        throw std::runtime_error(fmt::format("Failed to read shader {}", path.generic_string()));
+    }
+    files.push_back({ path, time });
+
+    std::string source;
+    std::string line;
+    const std::string include = "#include \"";
+    while (std::getline(file, line)) {
+        if (line.compare(0, include.size(), include) == 0) {
+            auto name = line.substr(include.size(), line.find('"', include.size()) - include.size());
+            source += Preprocess(path.parent_path() / name, files, depth + 1);
+        } else {
+            source += line;
+            source += '\n';
+        }
+    }
+    return source;
+}
+
+Shader
+Shader::Load(const std::string& vpath, const std::string& fpath, const ShaderCache* cache)
+{
+    std::vector<File> files;
+    auto vsrc = Preprocess(vpath, files, 0);
+    auto fsrc = Preprocess(fpath, files, 0);
+    Shader shader(vsrc, fsrc, cache);
+    shader.paths_ = { vpath, fpath };
+    shader.files_ = std::move(files);
+    return shader;
+}
+
+bool
+Shader::reload()
+{
+    bool changed = false;
+    for (auto& file : this->files_) {
+        std::error_code error;
+        auto time = fs::last_write_time(file.path, error);
+        changed |= !error && time != file.time;
+    }
+    if (!changed) {
+        return false;
+    }
+
+    std::vector<File> files;
+    try {
+        auto vsrc = Preprocess(this->paths_[0], files, 0);
+        auto fsrc = Preprocess(this->paths_[1], files, 0);
+        this->assign(linkProgram(vsrc, fsrc, this->cache_));
+        this->files_ = std::move(files);
+        spdlog::info("Reloaded shader {}, {}", this->paths_[0].generic_string(), this->paths_[1].generic_string());
+        return true;
+    } catch (std::exception& ex) {
+        spdlog::error("Failed to reload shader {}, {}: {}",
+            this->paths_[0].generic_string(),
+            this->paths_[1].generic_string(),
+            ex.what());
+        // keep the current program, and don't try again until the files change again
+        for (auto& file : this->files_) {
+            std::error_code error;
+            file.time = fs::last_write_time(file.path, error);
+        }
+        return false;
+    }
+}
+
+void
+Shader::assign(GLuint handle)
+{
+    std::unordered_map<std::string, UniformBlock> blocks;
+    std::swap(blocks, this->uniformBlocks_);
+    glDeleteProgram(this->handle_);
+    this->handle_ = handle;
+
+    this->uniforms_.clear();
+    queryUniforms(this->handle_, this->uniforms_);
+    queryUniformBlocks(this->handle_, this->uniformBlocks_);
+    for (auto& [name, block] : blocks) {
+        this->bindUniformBlock(name, block.binding);
+    }
+}
+
 void
 Shader::attach() const
 {
@@ -133,4 +283,21 @@ Shader::uniforms() const
     return this->uniforms_;
 }
 
-} // namespace gfx
\ No newline at end of file
+void
+Shader::bindUniformBlock(const std::string& name, GLuint binding)
+{
+    auto it = this->uniformBlocks_.find(name);
+    if (it == this->uniformBlocks_.end()) {
+        return;
+    }
+    glUniformBlockBinding(this->handle_, it->second.index, binding);
+    it->second.binding = binding;
+}
+
+const std::unordered_map<std::string, UniformBlock>&
+Shader::uniformBlocks() const
+{
+    return this->uniformBlocks_;
+}
+
+} // namespace gfx
@@ -6,6 +6,8 @@
 
 namespace gfx {
 
+class ShaderCache;
+
 struct Uniform
 {
     std::string name;
@@ -15,26 +17,77 @@ struct Uniform
     int length;
 }; // struct Uniform
 
+struct UniformBlock
+{
+    std::string name;
+    GLuint index;
+    // size of the block's data in bytes
+    int size;
+    GLuint binding;
+}; // struct UniformBlock
+
 class Shader final
 {
 public:
-    Shader(const std::string& vsrc, const std::string& fsrc);
+    /**
+     * Compile and link a program. Throws std::runtime_error with the info log if either fails.
+     * @param cache used to skip compiling if a binary of the same sources is cached, may be null
+     */
+    Shader(const std::string& vsrc, const std::string& fsrc, const ShaderCache* cache = nullptr);
     ~Shader();
     Shader(const Shader& other) = delete;
     Shader& operator=(const Shader& other) = delete;
     Shader(Shader&& other);
     Shader& operator=(Shader&& other);
 
+    /**
+     * Load a program from a vertex and a fragment shader file.
+     * A line `#include "file"` is replaced with the contents of that file, relative to the including one.
+     * Throws std::runtime_error if a file can't be read, or the program fails to compile or link.
+     */
+    static Shader Load(const std::string& vpath, const std::string& fpath, const ShaderCache* cache = nullptr);
+    /**
+     * Recompile a program loaded with Shader::Load if any of its files changed since it was last compiled.
+     * On errors, they are logged and the current program is kept.
+     * Uniform locations may change, uniform block bindings are kept.
+     * @return whether the program was replaced
+     */
+    bool reload();
+
     void attach() const;
     void detach() const;
 
     GLuint handle() const;
     const Uniform& uniform(const std::string& name) const;
     const std::unordered_map<std::string, Uniform>& uniforms() const;
+    /**
+     * Source the uniform block `name` from the buffer bound to `binding`, see UniformBuffer.
+     * Does nothing if the program has no such active block.
+     */
+    void bindUniformBlock(const std::string& name, GLuint binding);
+    const std::unordered_map<std::string, UniformBlock>& uniformBlocks() const;
 
 private:
+    struct File
+    {
+        fs::path path;
+        fs::file_time_type time;
+    }; // struct File
+
+    /**
+     * Read a shader file, resolving includes. Every file read is added to `files`.
+     */
+    static std::string Preprocess(const fs::path& path, std::vector<File>& files, int depth);
+    // replace the program, keeping uniform block bindings
+    void assign(GLuint handle);
+
     GLuint handle_;
     std::unordered_map<std::string, Uniform> uniforms_;
+    std::unordered_map<std::string, UniformBlock> uniformBlocks_;
+    const ShaderCache* cache_;
+    // when loaded from files: vertex and fragment shader paths, and every file read while loading them
+    std::array<fs::path, 2> paths_;
+    std::vector<File> files_;
 }; // class Shader
 
 } // namespace gfx
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "shader_cache.hpp"
+
+namespace gfx {
+
+/**
+ * 64-bit FNV-1a, unlike std::hash it's the same across runs and standard libraries.
+ */
+static uint64_t
+fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ull)
+{
+    for (auto c : data) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+ShaderCache::ShaderCache(const std::string& directory)
+  : directory_(directory)
+  , driver_()
+  , supported_(false)
+{
+    for (auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        auto* string = reinterpret_cast<const char*>(glGetString(name));
+        this->driver_ += string != nullptr ? string : "";
+        this->driver_ += '\n';
+    }
+    if (GLAD_GL_VERSION_4_1) {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        this->supported_ = formats > 0;
+    }
+    if (!this->supported_) {
+        spdlog::info("Program binaries are not supported, shaders will be compiled on every start");
+    }
+}
+
+GLuint
+ShaderCache::load(const std::string& vsrc, const std::string& fsrc) const
+{
+    if (!this->supported_) {
+        return 0;
+    }
+    std::ifstream file(this->path(vsrc, fsrc), std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+    GLenum format = 0;
+    if (!file.read(reinterpret_cast<char*>(&format), sizeof(format))) {
+        return 0;
+    }
+    std::vector<char> binary(std::istreambuf_iterator<char>(file), {});
+    if (binary.empty()) {
+        return 0;
+    }
+
+    // the driver may still reject a binary, e.g. after an update which didn't change its version string
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void
+ShaderCache::store(const std::string& vsrc, const std::string& fsrc, GLuint program) const
+{
+    if (!this->supported_) {
+        return;
+    }
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    try {
+        fs::create_directories(this->directory_);
+        std::ofstream file(this->path(vsrc, fsrc), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(binary.data(), length);
+    } catch (std::exception& ex) {
+        spdlog::warn("Failed to store program binary in {}: {}", this->directory_.generic_string(), ex.what());
+    }
+}
+
+bool
+ShaderCache::supported() const noexcept
+{
+    return this->supported_;
+}
+
+fs::path
+ShaderCache::path(const std::string& vsrc, const std::string& fsrc) const
+{
+    auto hash = fnv1a(this->driver_, fnv1a(fsrc, fnv1a(vsrc + '\0')));
+    return this->directory_ / fmt::format("{:016x}.bin", hash);
+}
+
+} // namespace gfx
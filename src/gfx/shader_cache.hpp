@@ -0,0 +1,49 @@
+#include "pch.h"
+
+#ifndef TEDIT_SHADER_CACHE_
+#define TEDIT_SHADER_CACHE_
+
+#include "gfx/gl.h"
+
+namespace gfx {
+
+/**
+ * On-disk cache of linked program binaries, see glGetProgramBinary.
+ * Binaries are keyed by a hash of the shader sources and the driver, so editing a shader or updating the driver
+ * simply misses the cache. Any failure to read or write the cache falls back to compiling from source.
+ */
+class ShaderCache final
+{
+public:
+    /**
+     * @param directory where binaries are stored, created when the first one is
+     */
+    explicit ShaderCache(const std::string& directory);
+    ShaderCache(const ShaderCache& other) = delete;
+    ShaderCache& operator=(const ShaderCache& other) = delete;
+
+    /**
+     * @return a new linked program, or 0 if there is no valid binary for these sources
+     */
+    GLuint load(const std::string& vsrc, const std::string& fsrc) const;
+    /**
+     * Store the binary of `program`, which has to be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+     */
+    void store(const std::string& vsrc, const std::string& fsrc, GLuint program) const;
+    /**
+     * Whether the driver supports program binaries at all.
+     */
+    bool supported() const noexcept;
+
+private:
+    fs::path path(const std::string& vsrc, const std::string& fsrc) const;
+
+    fs::path directory_;
+    // vendor, renderer and version of the driver
+    std::string driver_;
+    bool supported_;
+}; // class ShaderCache
+
+} // namespace gfx
+
+#endif // TEDIT_SHADER_CACHE_
@@ -0,0 +1,288 @@
+#include "pch.h"
+#include "sprite_batch.hpp"
+
+namespace gfx {
+
+static_assert(sizeof(SpriteBatch::Vertex) == sizeof(float) * 8, "Vertex must be tightly packed");
+static_assert(sizeof(SpriteBatch::Sprite) == sizeof(float) * 14, "Sprite must be tightly packed");
+static_assert(SpriteBatch::PAGE_SPRITES * 4 <= 1 << 16, "page indices must fit 16 bits");
+
+/**
+ * LSD radix sort of 64-bit keys, one byte per pass.
+ * Passes where all keys have the same byte are skipped, so keys which only differ in a few bytes take a few passes.
+ */
+static void
+radix_sort(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch)
+{
+    if (keys.empty()) {
+        return;
+    }
+    scratch.resize(keys.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::array<size_t, 256> offsets = {};
+        for (auto key : keys) {
+            offsets[(key >> shift) & 0xFF]++;
+        }
+        if (offsets[(keys[0] >> shift) & 0xFF] == keys.size()) {
+            continue;
+        }
+        // counts -> offsets of each bucket
+        size_t offset = 0;
+        for (auto& bucket : offsets) {
+            offset += std::exchange(bucket, offset);
+        }
+        for (auto key : keys) {
+            scratch[offsets[(key >> shift) & 0xFF]++] = key;
+        }
+        keys.swap(scratch);
+    }
+}
+
+SpriteBatch::SpriteBatch()
+  : vertices_(PAGE_SPRITES * 4 * sizeof(Vertex))
+  , vao_(0)
+  , indices_(0)
+  , white_(GL_TEXTURE_2D, 1, 1, 1, GL_RGBA8)
+  , sprites_()
+  , images_()
+  , keys_()
+  , scratch_()
+  , layered_(false)
+  , groups_()
+  , next_()
+  , sorted_()
+  , expanded_(PAGE_SPRITES * 4)
+  , runs_()
+{
+    uint32_t white = 0xFFFFFFFF;
+    this->white_.write(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &white, 1);
+
+    // the same two triangles for every sprite of a page
+    std::vector<uint16_t> indices;
+    indices.reserve(PAGE_SPRITES * 6);
+    for (uint32_t i = 0; i < PAGE_SPRITES * 4; i += 4) {
+        for (auto index : { 0, 1, 3, 1, 2, 3 }) {
+            indices.push_back(static_cast<uint16_t>(i + index));
+        }
+    }
+
+    // the vertex buffer is bound per page when drawing
+    glGenVertexArrays(1, &this->vao_);
+    glBindVertexArray(this->vao_);
+    glGenBuffers(1, &this->indices_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indices_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribFormat(0, 2, GL_FLOAT, false, offsetof(Vertex, position));
+    glVertexAttribFormat(1, 2, GL_FLOAT, false, offsetof(Vertex, uv));
+    glVertexAttribFormat(2, 4, GL_FLOAT, false, offsetof(Vertex, color));
+    for (GLuint attribute = 0; attribute < 3; ++attribute) {
+        glVertexAttribBinding(attribute, 0);
+        glEnableVertexAttribArray(attribute);
+    }
+    glBindVertexArray(NULL);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, NULL);
+}
+
+SpriteBatch::~SpriteBatch()
+{
+    glDeleteVertexArrays(1, &this->vao_);
+    glDeleteBuffers(1, &this->indices_);
+}
+
+void
+SpriteBatch::insert(const Image* image, const Sprite& sprite, uint8_t layer)
+{
+    // the sequence keeps the sort stable, and points back at the sprite
+    this->keys_.push_back((uint64_t)layer << 32 | this->sprites_.size());
+    this->layered_ |= layer != 0;
+    this->sprites_.push_back(sprite);
+    this->images_.push_back(image != nullptr ? image : &this->white_);
+}
+
+void
+SpriteBatch::prepare()
+{
+    this->runs_.clear();
+    if (this->sprites_.empty()) {
+        return;
+    }
+    if (this->layered_) {
+        radix_sort(this->keys_, this->scratch_);
+    }
+
+    // group sprites by image where that doesn't change the result
+    this->groups_.clear();
+    this->next_.resize(this->sprites_.size());
+    for (auto key : this->keys_) {
+        auto sequence = static_cast<uint32_t>(key & 0xFFFFFFFF);
+        auto layer = static_cast<uint8_t>(key >> 32);
+        const auto& sprite = this->sprites_[sequence];
+        auto* image = this->images_[sequence];
+        auto extent = glm::abs(sprite.axisX) + glm::abs(sprite.axisY);
+        glm::vec4 bounds = { sprite.center - extent, sprite.center + extent };
+
+        // walk back through the recent groups, until one has the same image, or overlaps the sprite
+        // layers are drawn separately, so groups never span several of them
+        auto group = this->groups_.size();
+        auto window = std::min(this->groups_.size(), REORDER_WINDOW);
+        for (auto i = this->groups_.size(); i-- > this->groups_.size() - window;) {
+            const auto& other = this->groups_[i];
+            if (other.layer != layer) {
+                break;
+            }
+            if (other.image->handle() == image->handle()) {
+                group = i;
+                break;
+            }
+            if (other.bounds.x < bounds.z && bounds.x < other.bounds.z && other.bounds.y < bounds.w &&
+                bounds.y < other.bounds.w) {
+                break;
+            }
+        }
+
+        this->next_[sequence] = UINT32_MAX;
+        if (group == this->groups_.size()) {
+            this->groups_.push_back({ image, sequence, sequence, bounds, layer });
+        } else {
+            auto& joined = this->groups_[group];
+            this->next_[joined.last] = sequence;
+            joined.last = sequence;
+            joined.bounds = { glm::min(glm::vec2(joined.bounds), glm::vec2(bounds)),
+                glm::max(glm::vec2(joined.bounds.z, joined.bounds.w), glm::vec2(bounds.z, bounds.w)) };
+        }
+    }
+
+    // sprites in draw order, each group split into runs at page boundaries
+    this->sorted_.clear();
+    for (const auto& group : this->groups_) {
+        for (auto sequence = group.first; sequence != UINT32_MAX; sequence = this->next_[sequence]) {
+            auto index = this->sorted_.size();
+            if (sequence == group.first || index % PAGE_SPRITES == 0) {
+                this->runs_.push_back({ group.image,
+                    index / PAGE_SPRITES,
+                    static_cast<uint32_t>(index % PAGE_SPRITES),
+                    0,
+                    group.layer });
+            }
+            this->runs_.back().count++;
+            this->sorted_.push_back(this->sprites_[sequence]);
+        }
+    }
+
+    // one page at a time, so that page `i` holds sprites [i * PAGE_SPRITES, (i + 1) * PAGE_SPRITES)
+    auto count = this->sorted_.size();
+    for (size_t first = 0; first < count; first += PAGE_SPRITES) {
+        auto length = std::min(count - first, PAGE_SPRITES);
+        expand(this->sorted_.data() + first, length, this->expanded_.data());
+        this->vertices_.insert(this->expanded_.data(), length * 4 * sizeof(Vertex));
+    }
+    this->vertices_.flush();
+}
+
+size_t
+SpriteBatch::draw(const std::function<void(const Image&)>& bind, uint8_t first, uint8_t last)
+{
+    glBindVertexArray(this->vao_);
+    size_t page = SIZE_MAX;
+    GLuint texture = 0;
+    size_t draws = 0;
+    for (const auto& run : this->runs_) {
+        if (run.layer < first || run.layer > last) {
+            continue;
+        }
+        if (run.page != page) {
+            page = run.page;
+            glBindVertexBuffer(0, this->vertices_.handle(page), this->vertices_.offset(), sizeof(Vertex));
+        }
+        if (run.image->handle() != texture) {
+            texture = run.image->handle();
+            bind(*run.image);
+        }
+        glDrawElements(GL_TRIANGLES,
+            run.count * 6,
+            GL_UNSIGNED_SHORT,
+            reinterpret_cast<const void*>(run.first * 6 * sizeof(uint16_t)));
+        draws++;
+    }
+    glBindVertexArray(NULL);
+    return draws;
+}
+
+void
+SpriteBatch::clear()
+{
+    this->vertices_.clear();
+    this->sprites_.clear();
+    this->images_.clear();
+    this->keys_.clear();
+    this->layered_ = false;
+    this->runs_.clear();
+}
+
+void
+SpriteBatch::persistent(bool enabled)
+{
+    this->vertices_.persistent(enabled);
+}
+
+size_t
+SpriteBatch::size() const noexcept
+{
+    return this->sprites_.size();
+}
+
+uint8_t
+SpriteBatch::lowestLayer() const noexcept
+{
+    // runs are in layer order
+    return this->runs_.empty() ? 0 : this->runs_.front().layer;
+}
+
+void
+SpriteBatch::expand(const Sprite* sprites, size_t count, Vertex* vertices)
+{
+#ifdef TEDIT_SSE2
+    // one lane per corner: top right, bottom right, bottom left, top left
+    const __m128 signX = _mm_setr_ps(1.f, 1.f, -1.f, -1.f);
+    const __m128 signY = _mm_setr_ps(1.f, -1.f, -1.f, 1.f);
+    const __m128 cornerU = _mm_setr_ps(1.f, 1.f, 0.f, 0.f);
+    const __m128 cornerV = _mm_setr_ps(1.f, 0.f, 0.f, 1.f);
+    for (size_t i = 0; i < count; ++i) {
+        const auto& sprite = sprites[i];
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(signX, _mm_set1_ps(sprite.axisX.x)),
+                                  _mm_mul_ps(signY, _mm_set1_ps(sprite.axisY.x))),
+            _mm_set1_ps(sprite.center.x));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(signX, _mm_set1_ps(sprite.axisX.y)),
+                                  _mm_mul_ps(signY, _mm_set1_ps(sprite.axisY.y))),
+            _mm_set1_ps(sprite.center.y));
+        __m128 u = _mm_add_ps(_mm_mul_ps(cornerU, _mm_set1_ps(sprite.uv.z)), _mm_set1_ps(sprite.uv.x));
+        __m128 v = _mm_add_ps(_mm_mul_ps(cornerV, _mm_set1_ps(sprite.uv.w)), _mm_set1_ps(sprite.uv.y));
+        // lanes by attribute -> lanes by corner, each register then holds a vertex' position and uv
+        _MM_TRANSPOSE4_PS(x, y, u, v);
+        __m128 color = _mm_loadu_ps(&sprite.color.x);
+        auto* out = reinterpret_cast<float*>(vertices + i * 4);
+        _mm_storeu_ps(out + 0, x);
+        _mm_storeu_ps(out + 4, color);
+        _mm_storeu_ps(out + 8, y);
+        _mm_storeu_ps(out + 12, color);
+        _mm_storeu_ps(out + 16, u);
+        _mm_storeu_ps(out + 20, color);
+        _mm_storeu_ps(out + 24, v);
+        _mm_storeu_ps(out + 28, color);
+    }
+#else
+    static const std::array<glm::vec2, 4> signs = { { { 1.f, 1.f }, { 1.f, -1.f }, { -1.f, -1.f }, { -1.f, 1.f } } };
+    static const std::array<glm::vec2, 4> corners = { { { 1.f, 1.f }, { 1.f, 0.f }, { 0.f, 0.f }, { 0.f, 1.f } } };
+    for (size_t i = 0; i < count; ++i) {
+        const auto& sprite = sprites[i];
+        for (size_t corner = 0; corner < 4; ++corner) {
+            auto sign = signs[corner];
+            vertices[i * 4 + corner] = { sign.x * sprite.axisX + sign.y * sprite.axisY + sprite.center,
+                corners[corner] * glm::vec2(sprite.uv.z, sprite.uv.w) + glm::vec2(sprite.uv.x, sprite.uv.y),
+                sprite.color };
+        }
+    }
+#endif
+}
+
+} // namespace gfx
@@ -0,0 +1,138 @@
+#include "pch.h"
+
+#ifndef TEDIT_SPRITE_BATCH_
+#define TEDIT_SPRITE_BATCH_
+
+#include "gfx/gl.h"
+#include "gfx/batch.hpp"
+#include "gfx/image.hpp"
+
+namespace gfx {
+
+/**
+ * Quads drawn in the order they were inserted, textured or not, from a single stream of vertices.
+ * Sprites are kept compact until they are drawn, then expanded into four vertices each, with the four corners
+ * of a sprite computed at once with SSE2 where available.
+ *
+ * Consecutive sprites with the same image are drawn with a single draw call. Sprites without an image sample
+ * a white texel, so runs of colored quads and lines are too. A sprite may also join an earlier run with its image
+ * on the same layer, as long as it doesn't overlap any sprite drawn in between, so the result is the same as
+ * drawing in order.
+ */
+class SpriteBatch final
+{
+public:
+    /**
+     * Sprites per page of vertices, a page never needs more than 16-bit indices.
+     */
+    static const size_t PAGE_SPRITES = 4096;
+    /**
+     * Number of most recent runs a sprite may join.
+     */
+    static const size_t REORDER_WINDOW = 8;
+
+    struct Vertex
+    {
+        glm::vec2 position;
+        glm::vec2 uv;
+        glm::vec4 color;
+    }; // struct Vertex
+
+    /**
+     * A quad with corners at `center` +/- `axisX` +/- `axisY`, so any affine transform of a square.
+     * `uv` is { u, v, width, height } of the image rectangle, `color` is multiplied with the image.
+     */
+    struct Sprite
+    {
+        glm::vec2 center;
+        glm::vec2 axisX;
+        glm::vec2 axisY;
+        glm::vec4 uv;
+        glm::vec4 color;
+    }; // struct Sprite
+
+    SpriteBatch();
+    ~SpriteBatch();
+    SpriteBatch(const SpriteBatch& other) = delete;
+    SpriteBatch& operator=(const SpriteBatch& other) = delete;
+
+    /**
+     * Insert a sprite. Lower layers are drawn first, within a layer sprites are drawn in insertion order.
+     * @param image GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY image, whose first layer is sampled, or nullptr for none
+     */
+    void insert(const Image* image, const Sprite& sprite, uint8_t layer = 0);
+    /**
+     * Sort the sprites by layer, expand them into vertices, and upload those. Call before drawing.
+     */
+    void prepare();
+    /**
+     * Draw the prepared sprites on layers from `first` to `last`, with the vertex attributes 0: position, 1: uv,
+     * 2: color. `bind` is called whenever the image changes, and has to bind it to the shader.
+     * @return the number of draw calls
+     */
+    size_t draw(const std::function<void(const Image&)>& bind, uint8_t first = 0, uint8_t last = UINT8_MAX);
+    /**
+     * Remove all sprites. Call after drawing.
+     */
+    void clear();
+
+    /**
+     * See Batch::persistent.
+     */
+    void persistent(bool enabled);
+    size_t size() const noexcept;
+    /**
+     * The lowest layer of any sprite, once prepared.
+     */
+    uint8_t lowestLayer() const noexcept;
+
+    /**
+     * Write four vertices per sprite to `vertices`, in the order matching the page's indices.
+     */
+    static void expand(const Sprite* sprites, size_t count, Vertex* vertices);
+
+private:
+    // sprites drawn with the same image, chained through `next_`
+    struct Group
+    {
+        const Image* image;
+        uint32_t first;
+        uint32_t last;
+        // union of the sprites' bounds, as { left, bottom, right, top }
+        glm::vec4 bounds;
+        uint8_t layer;
+    }; // struct Group
+
+    // consecutive sprites drawn with the same image from the same page
+    struct Run
+    {
+        const Image* image;
+        size_t page;
+        uint32_t first;
+        uint32_t count;
+        uint8_t layer;
+    }; // struct Run
+
+    Batch vertices_;
+    GLuint vao_;
+    GLuint indices_;
+    // sampled by sprites without an image
+    Image white_;
+    std::vector<Sprite> sprites_;
+    std::vector<const Image*> images_;
+    // layer | sequence, only sorted if any sprite isn't on layer 0
+    std::vector<uint64_t> keys_;
+    std::vector<uint64_t> scratch_;
+    bool layered_;
+    std::vector<Group> groups_;
+    // next sprite of the same group, by sequence
+    std::vector<uint32_t> next_;
+    // sprites in draw order, and the vertices of one page
+    std::vector<Sprite> sorted_;
+    std::vector<Vertex> expanded_;
+    std::vector<Run> runs_;
+}; // class SpriteBatch
+
+} // namespace gfx
+
+#endif // TEDIT_SPRITE_BATCH_
@@ -0,0 +1,69 @@
+#include "pch.h"
+#include "uniform_buffer.hpp"
+
+namespace gfx {
+
+UniformBuffer::UniformBuffer(GLuint binding, size_t size)
+  : binding_(binding)
+  , size_(size)
+  , buffer_()
+{
+    glGenBuffers(1, &this->buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, NULL);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, this->buffer_);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers(1, &this->buffer_);
+}
+
+UniformBuffer::UniformBuffer(UniformBuffer&& other)
+  : binding_(other.binding_)
+  , size_(std::exchange(other.size_, 0))
+  , buffer_(std::exchange(other.buffer_, 0))
+{}
+UniformBuffer&
+UniformBuffer::operator=(UniformBuffer&& other)
+{
+    if (this != &other) {
+        glDeleteBuffers(1, &this->buffer_);
+        this->binding_ = other.binding_;
+        this->size_ = std::exchange(other.size_, 0);
+        this->buffer_ = std::exchange(other.buffer_, 0);
+    }
+    return *this;
+}
+
+void
+UniformBuffer::upload(const void* data, size_t length)
+{
+    if (length > this->size_) {
+        throw std::length_error(fmt::format("UniformBuffer upload of {} bytes exceeds size {}", length, this->size_));
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, this->buffer_);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, length, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, NULL);
+}
+
+GLuint
+UniformBuffer::handle() const noexcept
+{
+    return this->buffer_;
+}
+
+GLuint
+UniformBuffer::binding() const noexcept
+{
+    return this->binding_;
+}
+
+size_t
+UniformBuffer::size() const noexcept
+{
+    return this->size_;
+}
+
+} // namespace gfx
@@ -0,0 +1,41 @@
+#include "pch.h"
+
+#ifndef TEDIT_UNIFORM_BUFFER_
+#define TEDIT_UNIFORM_BUFFER_
+
+#include "gfx/gl.h"
+
+namespace gfx {
+
+/**
+ * Buffer backing a uniform block, shared by every program with the block bound to the same binding point.
+ * This is a wrapper over an OpenGL buffer object of fixed size, which stays bound to its binding point,
+ * see Shader::bindUniformBlock. Data must be laid out according to std140.
+ */
+class UniformBuffer final
+{
+public:
+    UniformBuffer(GLuint binding, size_t size);
+    ~UniformBuffer();
+    UniformBuffer(const UniformBuffer& other) = delete;
+    UniformBuffer& operator=(const UniformBuffer& other) = delete;
+    UniformBuffer(UniformBuffer&& other);
+    UniformBuffer& operator=(UniformBuffer&& other);
+
+    /**
+     * Replace the contents of the buffer. `length` may not exceed its size.
+     */
+    void upload(const void* data, size_t length);
+    GLuint handle() const noexcept;
+    GLuint binding() const noexcept;
+    size_t size() const noexcept;
+
+private:
+    GLuint binding_;
+    size_t size_;
+    GLuint buffer_;
+}; // class UniformBuffer
+
+} // namespace gfx
+
+#endif // TEDIT_UNIFORM_BUFFER_
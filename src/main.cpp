@@ -3,6 +3,7 @@
 #include "gfx/gfx.hpp"
 #include "ui.hpp"
 #include "tile.hpp"
+#include "tilemap_renderer.hpp"
 
 /*
 
@@ -31,25 +32,14 @@ TODO: variable tilesize
 */
 
 void
-draw_tiles(gfx::Renderer* renderer, tile::TileMap* tilemap)
+draw_tiles(gfx::Renderer* renderer,
+    tile::TileMapRenderer* tilemapRenderer,
+    tile::TileMap* tilemap,
+    glm::vec4 visible,
+    float zoom)
 {
-    // TODO: center camera on tilemap instead of centering tilemap on camera.
-    float tileSize = (float)tilemap->tileSize();
-    float halfTileSize = tileSize / 2.f;
-    glm::vec3 tileScale = { halfTileSize, halfTileSize, 1.f };
-    for (size_t row = 0; row < tilemap->rows(); ++row) {
-        for (size_t column = 0; column < tilemap->columns(); ++column) {
-            auto tile = (*tilemap)(column, row);
-            auto tileset = tilemap->tileset(tile);
-            if (tileset == nullptr)
-                continue;
-            auto uv = tilemap->uv(tile);
-            auto model = glm::translate(glm::mat4(1), { halfTileSize + column * 32.f, halfTileSize + row * 32.f, 0.f });
-            model = glm::scale(model, tileScale);
-            renderer->submit(&tileset->atlas(), uv, model);
-        }
-        continue;
-    }
+    // tiles live on the GPU in chunks, only the visible ones that changed are rebuilt
+    tilemapRenderer->draw(*renderer, *tilemap, visible, zoom);
 }
 
 void
@@ -71,14 +61,64 @@ draw_grid(gfx::Renderer* renderer, glm::vec<2, size_t> mapSize, size_t tileSize,
         renderer->submit({ 120.f / 255.f, 120.f / 255.f, 120.f / 255.f, 100.f / 255.f }, model);
     }
 
-    // horizontal lines
-    for (size_t row = 0; row < mapSize.y + 1; ++row) {
-        renderer->submit({ 0.0f, row * tileSize }, { width, row * tileSize }, 1.f);
+    // the grid is drawn analytically on the GPU, its cost doesn't depend on the map size
+    renderer->submit(gfx::Renderer::GridCommand { { 0.f, 0.f }, { (float)width, (float)height }, (float)tileSize, 1.f });
+}
+
+/**
+ * Render a map without a window, e.g. to make a thumbnail of it, or to render on machines without a display or GPU.
+ * Frames are rendered until all tilesets are loaded, the last one is saved as a PNG file.
+ * @return the process exit code
+ */
+int
+render_headless(const std::string& executablePath,
+    const std::string& mapPath,
+    const std::string& outputPath,
+    int width,
+    int height)
+{
+    Window window("TEdit", width, height, Window::Backend::Headless);
+    gfx::Camera camera(&window);
+    gfx::Renderer renderer(executablePath);
+    tile::TileMapRenderer tilemapRenderer;
+    auto tilemap = tile::TileMap::Load(mapPath);
+    if (tilemap == nullptr) {
+        return 1;
+    }
+
+    // the whole map, centered, zoom takes scroll wheel steps of a tenth
+    glm::vec2 size = glm::vec2(tilemap->columns(), tilemap->rows()) * (float)tilemap->tileSize();
+    camera.move(size / 2.f);
+    auto fit = std::min(width / size.x, height / size.y);
+    camera.zoom((fit - camera.zoom()) * 10.f);
+    // the camera's zoom is limited, larger maps are cropped to their center, smaller ones don't fill the output
+    if (std::abs(camera.zoom() - fit) > 0.001f * fit) {
+        spdlog::warn("Map {} of {}x{} pixels needs a zoom of {:.3f} to fit {}x{}, it's rendered at {:.3f} instead",
+            mapPath,
+            size.x,
+            size.y,
+            fit,
+            width,
+            height,
+            camera.zoom());
     }
-    // vertical lines
-    for (size_t column = 0; column < mapSize.x + 1; ++column) {
-        renderer->submit({ column * tileSize, 0.0f }, { column * tileSize, height }, 1.f);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t frames = 0;
+    bool loading = true;
+    while (loading) {
+        // tilesets which finished loading during a frame are only drawn by the next one
+        loading = renderer.stats().pendingImages > 0 || frames == 0;
+        draw_tiles(&renderer, &tilemapRenderer, tilemap.get(), camera.visible(), camera.zoom());
+        renderer.render(camera);
+        window.swapBuffers();
+        frames++;
     }
+    spdlog::info("Rendered {} in {} frames, {:.1f} ms",
+        mapPath,
+        frames,
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return window.target()->color().save(outputPath) ? 0 : 1;
 }
 
 #if 0 // def _WIN32
@@ -89,10 +129,6 @@ int
 main(int argc, char** argv)
 #endif
 {
-    Window window("Test Window", 1600, 900);
-    gfx::Camera camera(&window);
-    gfx::Renderer renderer;
-
 #ifdef _WIN32
     CHAR path[MAX_PATH];
     GetModuleFileNameA(NULL, path, MAX_PATH);
@@ -101,6 +137,23 @@ main(int argc, char** argv)
 #else
     auto executablePath = fs::path(argv[0]).parent_path().generic_string();
 #endif
+
+    // tedit --headless <map.json> <output.png> [width height]
+    if (argc >= 4 && std::string(argv[1]) == "--headless") {
+        int width = argc >= 6 ? std::atoi(argv[4]) : 1600;
+        int height = argc >= 6 ? std::atoi(argv[5]) : 900;
+        try {
+            return render_headless(executablePath, argv[2], argv[3], std::max(width, 1), std::max(height, 1));
+        } catch (std::exception& ex) {
+            spdlog::error("Headless rendering failed: {}", ex.what());
+            return 1;
+        }
+    }
+
+    Window window("Test Window", 1600, 900);
+    gfx::Camera camera(&window);
+    gfx::Renderer renderer(executablePath);
+    tile::TileMapRenderer tilemapRenderer;
     ui::Context context(&window, executablePath);
 
     auto& state = context.state();
@@ -208,11 +261,22 @@ main(int argc, char** argv)
         camera.zoom(yoffset);
     });
     window.addResizeListener([&](int width, int height) { camera.resize(width, height); });
+    // edited shaders are picked up while waiting for input, only drawing a frame if any changed
+    window.addIdleListener([&]() { return renderer.reloadShaders(); });
 
     /* Loop until the user closes the window */
     while (!window.shouldClose()) {
-        /* Poll for and process events */
-        window.pollInput();
+        window.setPresentation(
+            state.render.lowLatency ? Window::Presentation::LowLatency : Window::Presentation::VSync);
+        /* Poll for and process events, or sleep until something needs to be redrawn */
+        if (state.render.continuous) {
+            window.pollInput();
+        } else {
+            window.waitInput(0.5);
+        }
+        // with low latency presentation, sleep until just before the frame has to start, so that the cursor and
+        // buttons read below for painting are as recent as possible when draw_tiles runs
+        window.waitFrame();
         context.poll();
 
         glm::dvec2 mouse;
@@ -229,7 +293,8 @@ main(int argc, char** argv)
                     auto col = std::floor(mouseInWorld.x / tileSize);
                     auto row = std::floor(mouseInWorld.y / tileSize);
                     if (col >= 0 && col < mapSize.x && row >= 0 && row < mapSize.y) {
-                        auto& tile = (*tilemap)(col, row);
+                        // read through the const overload, writing marks the tile's chunk for a rebuild
+                        auto tile = std::as_const(*tilemap)(col, row);
 
                         tile::Tile currentTile = state.currentTile;
                         // if we're holding shift, erase
@@ -239,7 +304,8 @@ main(int argc, char** argv)
                         }
                         // otherwise, paint
                         if (tile != currentTile) {
-                            tile = currentTile;
+                            (*tilemap)(col, row) = currentTile;
+                            window.invalidate();
 
                             if (state.tileMapSaved) {
                                 state.tileMapSaved = false;
@@ -250,11 +316,33 @@ main(int argc, char** argv)
                 }
             }
 
-            draw_tiles(&renderer, tilemap);
+            auto visible = camera.visible();
+            tilemapRenderer.setMode(state.render.tileIndexTexture ? tile::TileMapRenderer::Mode::TileIndex
+                                                                  : tile::TileMapRenderer::Mode::Chunks);
+            tilemapRenderer.setImpostors(state.render.impostors);
+            tilemapRenderer.setMipmaps(state.render.mipmaps);
+            draw_tiles(&renderer, &tilemapRenderer, tilemap, visible, camera.zoom());
             draw_grid(&renderer, mapSize, tilemap->tileSize(), mouseInWorld);
         }
 
+        renderer.setPersistentBuffers(state.render.persistentBuffers);
+        renderer.setOpaquePass(state.render.opaquePass);
+        // nothing is drawn while no map is open, an image of the last one must not be kept around
+        renderer.setSceneCache(state.render.sceneCache && tilemap != nullptr);
         renderer.render(camera);
+        // animated tiles keep changing without any input
+        if (auto next = tilemapRenderer.nextAnimationFrame(); next && tilemap != nullptr) {
+            window.invalidateIn(std::chrono::duration<double>(*next).count());
+        }
+        // images still being uploaded are drawn as placeholders until they're complete
+        if (renderer.stats().pendingImages > 0) {
+            window.invalidate();
+        }
+        state.renderStats.blendedSamples = renderer.stats().blendedSamples;
+        state.renderStats.opaqueSamples = renderer.stats().opaqueSamples;
+        state.renderStats.inputLatency = window.inputLatency().last * 1000.0;
+        state.renderStats.inputLatencyAverage = window.inputLatency().average * 1000.0;
+        state.renderStats.inputLatencyMax = window.inputLatency().max * 1000.0;
         context.render();
 
         /* Swap front and back buffers */
@@ -11,11 +11,14 @@
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <future>
 #include <thread>
 #include <functional>
 #include <optional>
 #include <array>
 #include <vector>
+#include <list>
 #include <string>
 #include <map>
 #include <set>
@@ -26,6 +29,20 @@
 #include <filesystem>
 namespace fs = std::filesystem;
 #include <cmath>
+#include <numeric>
+#include <limits>
+#include <chrono>
+
+// SIMD, SSE2 is part of every x86-64 CPU
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEDIT_SSE2
+#include <emmintrin.h>
+#endif
+
+// headless rendering, see Window::Backend::Headless, goes through Mesa's surfaceless EGL platform
+#if defined(__linux__)
+#define TEDIT_EGL
+#endif
 
 // GLM
 #include <glm/glm.hpp>
@@ -37,6 +37,7 @@ TaskQueue::poll()
         for (size_t i = 0; i < count; ++i) {
             Task task;
             if (this->queue_.try_dequeue(task)) {
+                --this->count_;
                 task();
             }
         }
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t threads)
+  : workers_()
+  , mutex_()
+  , wake_()
+  , done_()
+  , job_(nullptr)
+  , count_(0)
+  , next_(0)
+  , busy_(0)
+  , generation_(0)
+  , stop_(false)
+{
+    for (size_t i = 1; i < threads; ++i) {
+        this->workers_.emplace_back([this] { this->work(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->stop_ = true;
+    }
+    this->wake_.notify_all();
+    for (auto& worker : this->workers_) {
+        worker.join();
+    }
+}
+
+void
+ThreadPool::run(size_t count, const std::function<void(size_t)>& job)
+{
+    // not worth waking anyone up for
+    if (count == 1 || this->workers_.empty()) {
+        for (size_t i = 0; i < count; ++i) {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->job_ = &job;
+        this->count_ = count;
+        this->next_ = 0;
+        this->busy_ = this->workers_.size();
+        this->generation_++;
+    }
+    this->wake_.notify_all();
+
+    this->drain();
+
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->done_.wait(lock, [this] { return this->busy_ == 0; });
+    this->job_ = nullptr;
+}
+
+size_t
+ThreadPool::threads() const
+{
+    return this->workers_.size() + 1;
+}
+
+void
+ThreadPool::work()
+{
+    uint64_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->wake_.wait(lock, [&] { return this->stop_ || this->generation_ != generation; });
+            if (this->stop_) {
+                return;
+            }
+            generation = this->generation_;
+        }
+
+        this->drain();
+
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->busy_--;
+        }
+        this->done_.notify_one();
+    }
+}
+
+void
+ThreadPool::drain()
+{
+    for (auto i = this->next_++; i < this->count_; i = this->next_++) {
+        (*this->job_)(i);
+    }
+}
@@ -0,0 +1,51 @@
+#include "pch.h"
+
+#ifndef TEDIT_THREAD_POOL_
+#define TEDIT_THREAD_POOL_
+
+/**
+ * Fixed set of worker threads for splitting up CPU heavy work.
+ * The calling thread takes part in the work too, so a pool of N threads starts N - 1 workers.
+ */
+class ThreadPool final
+{
+public:
+    // more threads than this don't pay off for the amount of work we have
+    static const size_t MAX_THREADS = 8;
+
+    /**
+     * @param threads total number of threads, including the calling one. Defaults to the number of cores.
+     */
+    explicit ThreadPool(size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+                            MAX_THREADS));
+    ~ThreadPool();
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    /**
+     * Call `job` with every index in [0, count), spread over all threads. Returns once all calls are done.
+     * `job` must not call ThreadPool::run itself.
+     */
+    void run(size_t count, const std::function<void(size_t)>& job);
+    size_t threads() const;
+
+private:
+    void work();
+    // call `job_` with indices until there are none left
+    void drain();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(size_t)>* job_;
+    size_t count_;
+    std::atomic_size_t next_;
+    // workers still busy with the current job
+    size_t busy_;
+    // incremented for every job, so workers can tell a new job from a spurious wakeup
+    uint64_t generation_;
+    bool stop_;
+}; // class ThreadPool
+
+#endif // TEDIT_THREAD_POOL_
@@ -24,6 +24,26 @@ calculate_tile_uv(tile::Tile tile, int tileSize, int atlasWidth, int altasHeight
 
 namespace tile {
 
+/**
+ * Warn if `tileset` has more tiles of `tileSize` than a Tile can address, only the first TILE_IDS can be placed.
+ */
+static void
+check_tile_ids(const TileSet& tileset, uint32_t tileSize)
+{
+    auto& atlas = tileset.atlas();
+    auto tiles = tileSize > 0 ? (size_t)(atlas.width() / tileSize) * (atlas.height() / tileSize) : 0;
+    if (tiles > TILE_IDS) {
+        spdlog::warn("TileSet {} has {} tiles, only the first {} can be placed", tileset.source(), tiles, TILE_IDS);
+    }
+}
+
+static uint64_t
+next_revision()
+{
+    static uint64_t revision = 0;
+    return ++revision;
+}
+
 /*
 // clang-format off
 
@@ -63,7 +83,30 @@ TileSetId(Tile& tile, uint16_t value)
 
 TileSet::TileSet(const std::string& source)
   : source_(source)
-  , atlas_(source, GL_TEXTURE_2D)
+  , opaque_()
+  , transparent_()
+  , atlas_(gfx::Image::Load(source,
+        { GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST, true, true },
+        [this](const uint8_t* pixels, int width, int height) {
+            // one extra row and column of zeros, so the table can be read without bounds checks
+            this->opaque_.assign((size_t)(width + 1) * (height + 1), 0);
+            this->transparent_.assign((size_t)(width + 1) * (height + 1), 0);
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    auto alpha = pixels[((size_t)x + (size_t)y * width) * 4 + 3];
+                    auto at = (size_t)(x + 1) + (size_t)(y + 1) * (width + 1);
+                    auto left = at - 1, below = at - (width + 1), diagonal = below - 1;
+                    this->opaque_[at] =
+                        (alpha == 255) + this->opaque_[left] + this->opaque_[below] - this->opaque_[diagonal];
+                    this->transparent_[at] = (alpha == 0) + this->transparent_[left] + this->transparent_[below] -
+                                             this->transparent_[diagonal];
+                }
+            }
+        }))
+  , preview_()
+  , previewRevision_(0)
+  , animations_()
+  , animationRevision_(0)
 {}
 
 std::string
@@ -77,6 +120,107 @@ TileSet::atlas() const
     return this->atlas_;
 }
 
+Opacity
+TileSet::opacity(int x, int y, int width, int height) const
+{
+    // the tables are only complete once the atlas is
+    if (!this->atlas_.ready() || this->opaque_.empty()) {
+        return Opacity::Mixed;
+    }
+    auto atlasWidth = this->atlas_.width();
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > atlasWidth || y + height > this->atlas_.height()) {
+        return Opacity::Mixed;
+    }
+    auto count = [&](const std::vector<uint32_t>& table) {
+        auto at = [&](int x, int y) { return table[(size_t)x + (size_t)y * (atlasWidth + 1)]; };
+        return at(x + width, y + height) - at(x, y + height) - at(x + width, y) + at(x, y);
+    };
+    auto area = (uint32_t)(width * height);
+    if (count(this->opaque_) == area)
+        return Opacity::Opaque;
+    if (count(this->transparent_) == area)
+        return Opacity::Transparent;
+    return Opacity::Mixed;
+}
+
+void
+TileSet::setPalette(const std::vector<uint32_t>& colors)
+{
+    if (this->atlas_.indexed()) {
+        this->atlas_.writePalette(0, colors.data(), (int)colors.size());
+    }
+}
+
+const gfx::Image&
+TileSet::preview() const
+{
+    // the atlas has no texture, and no pixels until it's ready
+    auto* pixels = this->atlas_.data();
+    if (pixels == nullptr) {
+        return this->atlas_;
+    }
+    if (this->preview_ == nullptr || this->previewRevision_ != this->atlas_.paletteRevision()) {
+        auto atlasWidth = this->atlas_.width();
+        auto atlasHeight = this->atlas_.height();
+        // scaled down by the smallest whole factor that fits, picking the nearest atlas pixel
+        auto step = (std::max(atlasWidth, atlasHeight) + PREVIEW_SIZE - 1) / PREVIEW_SIZE;
+        auto width = (atlasWidth + step - 1) / step;
+        auto height = (atlasHeight + step - 1) / step;
+        std::vector<uint32_t> colors;
+        if (this->atlas_.indexed()) {
+            auto palette = this->atlas_.palette()->pixels();
+            colors.resize(palette.size() / 4);
+            std::memcpy(colors.data(), palette.data(), colors.size() * 4);
+        }
+        std::vector<uint32_t> preview((size_t)width * height);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                auto at = (size_t)x * atlasWidth / width + (size_t)y * atlasHeight / height * atlasWidth;
+                auto& color = preview[(size_t)x + (size_t)y * width];
+                if (this->atlas_.indexed()) {
+                    color = colors[pixels[at]];
+                } else {
+                    std::memcpy(&color, pixels + at * 4, sizeof(color));
+                }
+            }
+        }
+        this->preview_ = std::make_unique<gfx::Image>(GL_TEXTURE_2D, width, height, 1, GL_RGBA8);
+        this->preview_->write(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, preview.data(), width);
+        this->previewRevision_ = this->atlas_.paletteRevision();
+    }
+    return *this->preview_;
+}
+
+void
+TileSet::setAnimation(uint16_t tile, std::vector<AnimationFrame> frames)
+{
+    // the GPU picks the frame by taking the time modulo the animation's duration
+    for (const auto& frame : frames) {
+        if (frame.duration == 0 || frame.tile != TileId(frame.tile) || tile != TileId(tile)) {
+            spdlog::error("Invalid frame of animated tile {} in TileSet {}", tile, this->source_);
+            return;
+        }
+    }
+    if (frames.empty()) {
+        this->animations_.erase(tile);
+    } else {
+        this->animations_[tile] = std::move(frames);
+    }
+    this->animationRevision_++;
+}
+
+const std::map<uint16_t, std::vector<AnimationFrame>>&
+TileSet::animations() const
+{
+    return this->animations_;
+}
+
+uint32_t
+TileSet::animationRevision() const
+{
+    return this->animationRevision_;
+}
+
 TileMap::TileMap()
   : name_()
   , columns_()
@@ -86,7 +230,11 @@ TileMap::TileMap()
   , tileSetIdSequence_()
   , tileSets_()
   , tileSetPaths_()
-{}
+  , revision_()
+  , chunkRevisions_()
+{
+    this->invalidate();
+}
 
 TileMap::TileMap(const std::string& name, uint32_t columns, uint32_t rows, uint32_t tileSize)
   : name_(name)
@@ -97,10 +245,20 @@ TileMap::TileMap(const std::string& name, uint32_t columns, uint32_t rows, uint3
   , tileSetIdSequence_(0)
   , tileSets_()
   , tileSetPaths_()
+  , revision_()
+  , chunkRevisions_()
 {
     this->tiles_.resize(columns * rows, Tile(-1));
     this->tileSets_.resize((2 << 5) - 1, nullptr);
     this->tileSetPaths_.reserve((2 << 5) - 1);
+    this->invalidate();
+}
+
+void
+TileMap::invalidate()
+{
+    this->revision_ = next_revision();
+    this->chunkRevisions_.assign(this->chunkColumns() * this->chunkRows(), 0);
 }
 
 void
@@ -141,14 +299,17 @@ TileMap::resize(Direction direction, int count)
     this->columns_ = new_columns;
     this->rows_ = new_rows;
     this->tiles_ = std::move(new_tiles);
+    this->invalidate();
 }
 
 void
 TileMap::add(TileSet* tileset)
 {
     spdlog::info("Added TileSet {}@{} to TileMap {}", tileset->source(), (void*)tileset, this->name());
+    check_tile_ids(*tileset, this->tileSize_);
     this->tileSets_[tileSetIdSequence_++] = tileset;
     this->tileSetPaths_.push_back(tileset->source());
+    this->invalidate();
 }
 void
 TileMap::remove(TileSet* tileset)
@@ -157,6 +318,7 @@ TileMap::remove(TileSet* tileset)
         if (this->tileSets_[i] == tileset) {
             this->tileSets_.erase(this->tileSets_.begin() + i);
             this->tileSetPaths_.erase(this->tileSetPaths_.begin() + i);
+            this->invalidate();
             return;
         }
     }
@@ -170,6 +332,7 @@ TileMap::operator()(uint32_t x, uint32_t y) const
 Tile&
 TileMap::operator()(uint32_t x, uint32_t y)
 {
+    this->chunkRevisions_[(x / CHUNK_SIZE) + (y / CHUNK_SIZE) * this->chunkColumns()]++;
     return this->tiles_[x + y * columns_];
 }
 glm::vec4
@@ -178,10 +341,39 @@ TileMap::uv(Tile tile) const
     auto& atlas = this->tileSets_[TileSetId(tile)]->atlas();
     return calculate_tile_uv(tile, this->tileSize_, atlas.width(), atlas.height());
 }
+Opacity
+TileMap::opacity(Tile tile) const
+{
+    // same layout as calculate_tile_uv
+    auto* tileset = this->tileset(tile);
+    if (tileset == nullptr)
+        return Opacity::Transparent;
+    int tileSize = this->tileSize_;
+    auto perRow = tileset->atlas().width() / tileSize;
+    if (perRow == 0)
+        return Opacity::Mixed;
+    auto frameOpacity = [&](uint16_t id) {
+        return tileset->opacity((id / perRow) * tileSize, (id % perRow) * tileSize, tileSize, tileSize);
+    };
+    auto animation = tileset->animations().find(TileId(tile));
+    if (animation == tileset->animations().end())
+        return frameOpacity(TileId(tile));
+    auto opacity = frameOpacity(animation->second.front().tile);
+    for (const auto& frame : animation->second) {
+        if (frameOpacity(frame.tile) != opacity)
+            return Opacity::Mixed;
+    }
+    return opacity;
+}
+
 const TileSet*
 TileMap::tileset(Tile tile) const
 {
-    return this->tileSets_[TileSetId(tile)];
+    auto id = TileSetId(tile);
+    if (id < this->tileSets_.size())
+        return this->tileSets_[id];
+    else
+        return nullptr;
 }
 TileSet*
 TileMap::tileset(Tile tile)
@@ -219,11 +411,41 @@ TileMap::tilesets()
 {
     return this->tileSets_;
 }
+const std::vector<TileSet*>&
+TileMap::tilesets() const
+{
+    return this->tileSets_;
+}
+const std::vector<Tile>&
+TileMap::tiles() const
+{
+    return this->tiles_;
+}
 std::vector<std::string>&
 TileMap::tilesetPaths()
 {
     return this->tileSetPaths_;
 }
+uint32_t
+TileMap::chunkColumns() const
+{
+    return (this->columns_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+uint32_t
+TileMap::chunkRows() const
+{
+    return (this->rows_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+uint32_t
+TileMap::chunkRevision(uint32_t chunkX, uint32_t chunkY) const
+{
+    return this->chunkRevisions_[chunkX + chunkY * this->chunkColumns()];
+}
+uint64_t
+TileMap::revision() const
+{
+    return this->revision_;
+}
 
 static std::unordered_map<std::string, std::unique_ptr<TileSet>> tileSetCache;
 // NOTE: thread unsafe
@@ -249,9 +471,19 @@ TileMap::Save(TileMap& tm, const std::string& path)
     try {
         std::vector<std::string> tileSetSources;
         tileSetSources.reserve(tm.tileSets_.size());
+        json animations = json::array();
         for (auto ts : tm.tileSets_) {
             if (ts != nullptr) {
                 tileSetSources.emplace_back(ts->source());
+                json tileSetAnimations = json::array();
+                for (const auto& [tile, frames] : ts->animations()) {
+                    json animation = { { "tile", tile }, { "frames", json::array() } };
+                    for (const auto& frame : frames) {
+                        animation["frames"].push_back({ { "tile", frame.tile }, { "duration", frame.duration } });
+                    }
+                    tileSetAnimations.push_back(std::move(animation));
+                }
+                animations.push_back(std::move(tileSetAnimations));
             }
         }
 
@@ -264,6 +496,7 @@ TileMap::Save(TileMap& tm, const std::string& path)
         // TODO: layers
         out["tiles"] = tm.tiles_;
         out["tileSets"] = tileSetSources;
+        out["animations"] = animations;
         // clang-format on
 
         std::ofstream file(path);
@@ -294,8 +527,29 @@ TileMap::Load(const std::string& path)
         tileSetPaths.reserve((2 << 5) - 1);
         for (size_t i = 0; i < tileSetSources.size(); ++i) {
             tileSets[i] = TileSet::Load(tileSetSources[i]);
+            check_tile_ids(*tileSets[i], tileSize);
             tileSetPaths.emplace_back(std::move(tileSetSources[i]));
         }
+        // maps saved before tiles could be animated don't have any
+        for (size_t i = 0; i < tileSetPaths.size(); ++i) {
+            // tilesets are shared, it may still have the animations of a previously loaded map
+            auto previous = tileSets[i]->animations();
+            for (const auto& [tile, frames] : previous) {
+                tileSets[i]->setAnimation(tile, {});
+            }
+        }
+        if (json.contains("animations")) {
+            auto& animations = json["animations"];
+            for (size_t i = 0; i < tileSetPaths.size() && i < animations.size(); ++i) {
+                for (auto& animation : animations[i]) {
+                    std::vector<AnimationFrame> frames;
+                    for (auto& frame : animation["frames"]) {
+                        frames.push_back({ frame["tile"].get<uint16_t>(), frame["duration"].get<uint32_t>() });
+                    }
+                    tileSets[i]->setAnimation(animation["tile"].get<uint16_t>(), std::move(frames));
+                }
+            }
+        }
 
         auto out = std::make_unique<TileMap>();
         out->name_ = name;
@@ -305,6 +559,7 @@ TileMap::Load(const std::string& path)
         out->tiles_ = std::move(tiles);
         out->tileSets_ = std::move(tileSets);
         out->tileSetPaths_ = std::move(tileSetPaths);
+        out->invalidate();
         return std::move(out);
     } catch (std::exception& ex) {
         spdlog::error("Error while loading tile map {}, {}", path, ex.what());
@@ -24,6 +24,13 @@ TileMap {
 
         tiles: Tile[]
         tileSets: TileSet[],
+        // optional, one list per tileset, in the same order
+        animations: Animation[][],
+}
+
+Animation {
+        tile: number,
+        frames: { tile: number, duration: number }[],
 }
 
 In-memory representation:
@@ -32,6 +39,7 @@ Tile = U32;
 TileSet {
     string source
     Image atlas
+    animations: map<U16, vector<AnimationFrame>>
 }
 TileMap {
     name: string
@@ -48,6 +56,10 @@ TileMap {
 */
 
 using Tile = uint16_t;
+/**
+ * Tiles of a tileset a Tile can address, see TileId. Tiles of larger atlases past these can't be placed.
+ */
+const uint16_t TILE_IDS = 1 << 10;
 // Getter
 uint16_t TileId(const Tile& tile);
 // Getter
@@ -57,19 +69,94 @@ void TileId(Tile& tile, uint16_t value);
 // Setter
 void TileSetId(Tile& tile, uint16_t value);
 
+/**
+ * How much of a tile covers what's behind it.
+ */
+enum class Opacity
+{
+    // fully transparent, drawing it has no effect
+    Transparent,
+    // fully opaque, it can be drawn without blending
+    Opaque,
+    Mixed
+}; // enum class Opacity
+
+/**
+ * One frame of an animated tile: the tile of the same tileset shown in its place, for `duration` milliseconds.
+ */
+struct AnimationFrame
+{
+    uint16_t tile;
+    uint32_t duration;
+}; // struct AnimationFrame
+
+/**
+ * An atlas of tiles. The atlas loads in the background, see gfx::Image::Load, until it's ready all tiles are
+ * Opacity::Mixed. Atlases of at most 256 colors are kept as palette indices, see gfx::Image::indexed.
+ * Atlases are only kept as pixels in memory, without a texture of their own, TileMapRenderer pages them in from there.
+ * So they may be larger than the maximum texture size, and only take up video memory for the pages in use, though
+ * system memory for every pixel, as long as the tileset is loaded.
+ * Only their first TILE_IDS tiles can be placed though, e.g. a 1024x1024 atlas of 32 px tiles has no more.
+ */
 class TileSet
 {
 public:
+    /**
+     * Largest side of a preview, in texels. Larger atlases are shown at a lower resolution.
+     */
+    static const int PREVIEW_SIZE = 2048;
+
     TileSet(const std::string& source);
+    TileSet(const TileSet& other) = delete;
+    TileSet& operator=(const TileSet& other) = delete;
 
     std::string source() const;
     const gfx::Image& atlas() const;
+    /**
+     * Opacity of a rectangle of atlas pixels, in texture coordinates starting at the bottom left.
+     * Pixels outside of the atlas count as Opacity::Mixed.
+     */
+    Opacity opacity(int x, int y, int width, int height) const;
+    /**
+     * Replace the colors of an indexed atlas, e.g. to preview a variant of the tileset.
+     * Does nothing if the atlas isn't indexed.
+     * @param colors RGBA8, red in the lowest byte, at most 256
+     */
+    void setPalette(const std::vector<uint32_t>& colors);
+    /**
+     * The atlas in RGBA, for displaying it with ImGui, scaled down to at most PREVIEW_SIZE texels on either side.
+     * Its handle is 0 until the atlas is ready.
+     */
+    const gfx::Image& preview() const;
+    /**
+     * Animate a tile, so that wherever it's placed it cycles through `frames`, or stop animating it if that's empty.
+     * Animations are played on the GPU, see TileMapRenderer.
+     */
+    void setAnimation(uint16_t tile, std::vector<AnimationFrame> frames);
+    /**
+     * Frames of each animated tile, by tile id.
+     */
+    const std::map<uint16_t, std::vector<AnimationFrame>>& animations() const;
+    /**
+     * Incremented whenever an animation is set or removed.
+     */
+    uint32_t animationRevision() const;
 
     static TileSet* Load(const std::string& path);
 
 private:
     std::string source_;
+    // summed area tables of fully opaque and fully transparent atlas pixels, scanned once while loading,
+    // so any rectangle is classified in constant time regardless of the tile size
+    std::vector<uint32_t> opaque_;
+    std::vector<uint32_t> transparent_;
+    // after the tables, which are filled while it loads
     gfx::Image atlas_;
+    // created when first shown, and recreated after palette swaps
+    mutable std::unique_ptr<gfx::Image> preview_;
+    mutable uint32_t previewRevision_;
+    std::map<uint16_t, std::vector<AnimationFrame>> animations_;
+    uint32_t animationRevision_;
 }; // class TileSet
 
 class TileMap
@@ -78,6 +165,11 @@ public:
     // static const size_t MAX_COLUMNS = 2048;
     // static const size_t MAX_ROWS = 2048;
 
+    /**
+     * Tiles are grouped into square chunks of CHUNK_SIZE x CHUNK_SIZE tiles, which are rendered as one unit.
+     */
+    static const uint32_t CHUNK_SIZE = 32;
+
     TileMap();
     TileMap(const std::string& name, uint32_t columns, uint32_t rows, uint32_t tileSize);
 
@@ -97,9 +189,17 @@ public:
     void remove(TileSet* tileset);
 
     const Tile& operator()(uint32_t x, uint32_t y) const;
+    /**
+     * Marks the chunk containing the tile as changed, so only use this overload for writing.
+     */
     Tile& operator()(uint32_t x, uint32_t y);
 
     glm::vec4 uv(Tile tile) const;
+    /**
+     * Opacity of the part of its tileset's atlas the tile is drawn from. Animated tiles are only opaque or transparent
+     * if all of their frames are.
+     */
+    Opacity opacity(Tile tile) const;
     const TileSet* tileset(Tile tile) const;
     TileSet* tileset(Tile tile);
 
@@ -108,13 +208,32 @@ public:
     uint32_t rows() const;
     uint32_t tileSize() const;
     std::vector<TileSet*>& tilesets();
+    const std::vector<TileSet*>& tilesets() const;
+    /**
+     * All tiles, row by row.
+     */
+    const std::vector<Tile>& tiles() const;
     std::vector<std::string>& tilesetPaths();
 
+    uint32_t chunkColumns() const;
+    uint32_t chunkRows() const;
+    /**
+     * Incremented whenever a tile inside the chunk is written to.
+     */
+    uint32_t chunkRevision(uint32_t chunkX, uint32_t chunkY) const;
+    /**
+     * Changes whenever the map is resized or its tilesets change, at which point all chunks should be rebuilt.
+     * Unique across all tile maps.
+     */
+    uint64_t revision() const;
+
     static std::unique_ptr<TileMap> Create(const std::string& name, uint32_t columns, uint32_t rows);
     static void Save(TileMap& tm, const std::string& path);
     static std::unique_ptr<TileMap> Load(const std::string& path);
 
 private:
+    void invalidate();
+
     std::string name_;
     uint32_t columns_;
     uint32_t rows_;
@@ -123,6 +242,8 @@ private:
     size_t tileSetIdSequence_;
     std::vector<TileSet*> tileSets_;
     std::vector<std::string> tileSetPaths_;
+    uint64_t revision_;
+    std::vector<uint32_t> chunkRevisions_;
 }; // class TileMap
 
 } // namespace tile
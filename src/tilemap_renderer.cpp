@@ -0,0 +1,774 @@
+#include "pch.h"
+#include "tilemap_renderer.hpp"
+#include "tile.hpp"
+
+namespace tile {
+
+// impostors are pinned while their children are rendered, at most 4 per level, and so are those drawn in the same
+// frame, see TileMapRenderer::draw; some must remain evictable
+static_assert(TileMapRenderer::IMPOSTOR_BUDGET > 5 * TileMapRenderer::IMPOSTOR_LEVELS, "impostor budget too small");
+
+/**
+ * Range of chunks intersecting `visible`, as { first column, first row, last column, last row }, the last exclusive.
+ */
+static glm::uvec4
+visible_chunks(const TileMap& tilemap, glm::vec4 visible)
+{
+    float chunkSize = (float)(tilemap.tileSize() * TileMap::CHUNK_SIZE);
+    auto first = glm::max(glm::floor(glm::vec2(visible.x, visible.y) / chunkSize), glm::vec2(0));
+    auto last = glm::min(glm::floor(glm::vec2(visible.z, visible.w) / chunkSize) + 1.f,
+        glm::vec2(tilemap.chunkColumns(), tilemap.chunkRows()));
+    return { (uint32_t)first.x, (uint32_t)first.y, (uint32_t)std::max(last.x, 0.f), (uint32_t)std::max(last.y, 0.f) };
+}
+
+/**
+ * Range of impostors of `level` intersecting `visible`, like visible_chunks.
+ */
+static glm::uvec4
+visible_impostors(const TileMap& tilemap, glm::vec4 visible, uint32_t level)
+{
+    auto span = 1u << (level - 1);
+    float size = (float)(tilemap.tileSize() * TileMap::CHUNK_SIZE * span);
+    glm::vec2 count = { (tilemap.chunkColumns() + span - 1) / span, (tilemap.chunkRows() + span - 1) / span };
+    auto first = glm::max(glm::floor(glm::vec2(visible.x, visible.y) / size), glm::vec2(0));
+    auto last = glm::min(glm::floor(glm::vec2(visible.z, visible.w) / size) + 1.f, count);
+    return { (uint32_t)first.x, (uint32_t)first.y, (uint32_t)std::max(last.x, 0.f), (uint32_t)std::max(last.y, 0.f) };
+}
+
+TileMapRenderer::TileMapRenderer()
+  : mode_(Mode::Chunks)
+  , impostors_(true)
+  , changed_(false)
+  , revision_(0)
+  , tilesetsReady_(true)
+  , chunks_()
+  , tiles_()
+  , tileRevisions_()
+  , pages_()
+  , pageBudget_(DEFAULT_PAGE_BUDGET)
+  , mipmaps_(true)
+  , chunkPages_()
+  , pagesMissing_(false)
+  , uvScales_()
+  , tilesPerRow_()
+  , paletteRevisions_()
+  , paletteColors_()
+  , animations_()
+  , animatedTiles_()
+  , animationRows_()
+  , animationEnds_()
+  , animationFrames_()
+  , animationRevisions_()
+  , nextAnimationFrame_()
+  , impostorCache_()
+  , impostorLru_()
+  , impostorFrame_(0)
+  , workers_()
+  , pending_()
+  , bands_()
+  , staging_()
+  , mixed_()
+  , scratch_()
+  , visibleImpostors_()
+  , impostorCommands_()
+  , impostorInstances_()
+{}
+
+void
+TileMapRenderer::draw(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible, float zoom)
+{
+    auto& tilesets = tilemap.tilesets();
+    bool ready = this->tilesetsReady_ || std::all_of(tilesets.begin(), tilesets.end(), [](const TileSet* tileset) {
+        return tileset == nullptr || tileset->atlas().ready();
+    });
+    // animations change how tiles are drawn as much as replacing their tileset would
+    bool animationsChanged = false;
+    for (size_t id = 0; id < tilesets.size() && id < this->animationRevisions_.size(); ++id) {
+        auto revision = tilesets[id] != nullptr ? tilesets[id]->animationRevision() : 0;
+        animationsChanged |= revision != this->animationRevisions_[id];
+    }
+    // pages of indexed atlases in an RGBA cache have their colors baked in
+    bool palettesChanged = false;
+    if (this->pages_ != nullptr && !this->pages_->indexed()) {
+        for (size_t id = 0; id < tilesets.size() && id < this->paletteRevisions_.size(); ++id) {
+            palettesChanged |= tilesets[id] != nullptr && tilesets[id]->atlas().indexed() &&
+                               tilesets[id]->atlas().paletteRevision() != this->paletteRevisions_[id];
+        }
+    }
+    // the map was resized, replaced, its tilesets changed or finished loading, so everything is stale
+    if (tilemap.revision() != this->revision_ || ready != this->tilesetsReady_ || animationsChanged ||
+        palettesChanged) {
+        this->revision_ = tilemap.revision();
+        this->rebuildTilesets(tilemap);
+        this->rebuildAnimations(tilemap);
+        this->chunks_.clear();
+        this->chunkPages_.clear();
+        this->tiles_.reset();
+        this->impostorCache_.clear();
+        this->impostorLru_.clear();
+        this->changed_ = true;
+    }
+    if (this->pages_ == nullptr) {
+        return;
+    }
+    // palette swaps only recolor tiles, but impostors have the old colors baked in
+    if (this->pages_->indexed()) {
+        for (size_t id = 0; id < tilesets.size(); ++id) {
+            if (tilesets[id] == nullptr || !tilesets[id]->atlas().ready())
+                continue;
+            auto& atlas = tilesets[id]->atlas();
+            if (atlas.paletteRevision() != this->paletteRevisions_[id]) {
+                this->paletteRevisions_[id] = atlas.paletteRevision();
+                this->pages_->copyPalette((int)id, atlas);
+                this->impostorCache_.clear();
+                this->impostorLru_.clear();
+                this->changed_ = true;
+            }
+        }
+    }
+    // cached images of the scene are stale once any animated tile moves on to its next frame
+    this->nextAnimationFrame_.reset();
+    if (!this->animationEnds_.empty()) {
+        auto time = (uint32_t)renderer.time().count();
+        uint32_t next = UINT32_MAX;
+        for (size_t i = 0; i < this->animationEnds_.size(); ++i) {
+            auto& ends = this->animationEnds_[i];
+            auto offset = time % ends.back();
+            auto end = std::upper_bound(ends.begin(), ends.end(), offset);
+            next = std::min(next, *end - offset);
+            auto frame = (size_t)(end - ends.begin());
+            this->changed_ |= frame != this->animationFrames_[i];
+            this->animationFrames_[i] = frame;
+        }
+        this->nextAnimationFrame_ = std::chrono::milliseconds(next);
+    }
+
+    // the coarsest level whose impostors still have at least a texel per screen pixel
+    uint32_t level = 0;
+    float chunkSize = (float)(tilemap.tileSize() * TileMap::CHUNK_SIZE);
+    while (this->impostors_ && level < IMPOSTOR_LEVELS && IMPOSTOR_SIZE / (chunkSize * (1 << level)) >= zoom) {
+        ++level;
+    }
+    // impostors drawn in a frame stay cached until the next one, along with those pinned while rendering them, so if
+    // more of them are visible than the cache holds, e.g. in a very large window, coarser ones are drawn instead
+    while (level > 0 && level < IMPOSTOR_LEVELS) {
+        auto range = visible_impostors(tilemap, visible, level);
+        if ((size_t)(range.z - range.x) * (range.w - range.y) + 4 * level < IMPOSTOR_BUDGET) {
+            break;
+        }
+        ++level;
+    }
+
+    if (this->mode_ == Mode::TileIndex) {
+        this->drawTileIndex(renderer, tilemap, visible);
+    } else if (level > 0) {
+        this->drawImpostors(renderer, tilemap, visible, level);
+    } else {
+        this->drawChunks(renderer, tilemap, visible);
+    }
+
+    // tiles which were drawn before look different now
+    if (this->changed_) {
+        renderer.invalidateScene();
+        this->changed_ = false;
+    }
+}
+
+void
+TileMapRenderer::setMode(Mode mode)
+{
+    this->changed_ |= mode != this->mode_;
+    this->mode_ = mode;
+}
+
+TileMapRenderer::Mode
+TileMapRenderer::mode() const
+{
+    return this->mode_;
+}
+
+void
+TileMapRenderer::setImpostors(bool enabled)
+{
+    this->changed_ |= enabled != this->impostors_;
+    this->impostors_ = enabled;
+}
+
+void
+TileMapRenderer::setMipmaps(bool enabled)
+{
+    if (enabled != this->mipmaps_) {
+        this->mipmaps_ = enabled;
+        // like a new page budget, the cache is rebuilt by the next draw
+        this->revision_ = UINT64_MAX;
+    }
+}
+
+void
+TileMapRenderer::setPageBudget(size_t bytes)
+{
+    this->pageBudget_ = bytes;
+    // the cache is rebuilt with the new budget by the next draw, like after loading another map
+    this->revision_ = UINT64_MAX;
+}
+
+std::optional<std::chrono::milliseconds>
+TileMapRenderer::nextAnimationFrame() const
+{
+    return this->nextAnimationFrame_;
+}
+
+void
+TileMapRenderer::drawChunks(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible)
+{
+    auto chunkColumns = tilemap.chunkColumns();
+    auto chunkRows = tilemap.chunkRows();
+
+    if (this->chunks_.empty()) {
+        this->chunks_.reserve(chunkColumns * chunkRows);
+        for (size_t i = 0; i < chunkColumns * chunkRows; ++i) {
+            this->chunks_.push_back({ gfx::InstanceBuffer(GL_STATIC_DRAW), {}, 0, false });
+        }
+    }
+
+    auto range = visible_chunks(tilemap, visible);
+    this->pending_.clear();
+    for (auto chunkY = range.y; chunkY < range.w; ++chunkY) {
+        for (auto chunkX = range.x; chunkX < range.z; ++chunkX) {
+            auto& chunk = this->chunks_[chunkX + chunkY * chunkColumns];
+            if (!chunk.built || chunk.revision != tilemap.chunkRevision(chunkX, chunkY)) {
+                this->changed_ |= chunk.built;
+                this->pending_.push_back(chunkX + chunkY * chunkColumns);
+            }
+        }
+    }
+    this->rebuild(tilemap);
+
+    // chunks are drawn with the rest of the scene, so the pages of all of them have to be resident at once
+    this->pages_->begin();
+    for (auto chunkY = range.y; chunkY < range.w; ++chunkY) {
+        for (auto chunkX = range.x; chunkX < range.z; ++chunkX) {
+            auto& chunk = this->chunks_[chunkX + chunkY * chunkColumns];
+            if (!chunk.commands.empty()) {
+                this->requirePages(tilemap, chunkX, chunkY);
+                renderer.submit(chunk.instances, chunk.commands);
+            }
+        }
+    }
+}
+
+void
+TileMapRenderer::drawImpostors(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible, uint32_t level)
+{
+    float size = (float)(tilemap.tileSize() * TileMap::CHUNK_SIZE * (1u << (level - 1)));
+    auto range = visible_impostors(tilemap, visible, level);
+
+    // impostors are part of the scene, so they are drawn from an instance buffer instead of as sprites
+    this->visibleImpostors_.clear();
+    this->impostorCommands_.clear();
+    // the commands refer to the impostors' images, so rendering the next ones must not evict them
+    this->impostorFrame_++;
+    for (auto y = range.y; y < range.w; ++y) {
+        for (auto x = range.x; x < range.z; ++x) {
+            auto& image = this->impostor(renderer, tilemap, level, x, y);
+            this->impostorCache_.at((uint64_t)level << 48 | (uint64_t)y << 24 | x).frame = this->impostorFrame_;
+            glm::vec2 half = { size / 2.f, size / 2.f };
+            auto index = static_cast<uint32_t>(this->visibleImpostors_.size());
+            this->impostorCommands_.push_back({ &image, nullptr, index, 1 });
+            this->visibleImpostors_.push_back(
+                { glm::vec2(x * size, y * size) + half, half, { 0.f, 0.f, 1.f, 1.f }, 0.f, 0.f });
+        }
+    }
+    this->impostorInstances_.upload(this->visibleImpostors_.data(),
+        this->visibleImpostors_.size() * sizeof(gfx::Renderer::QuadInstance));
+    renderer.submit(this->impostorInstances_, this->impostorCommands_);
+}
+
+const gfx::Image&
+TileMapRenderer::impostor(gfx::Renderer& renderer, const TileMap& tilemap, uint32_t level, uint32_t x, uint32_t y)
+{
+    uint64_t key = (uint64_t)level << 48 | (uint64_t)y << 24 | x;
+    auto stamp = this->stamp(tilemap, level, x, y);
+
+    auto it = this->impostorCache_.find(key);
+    if (it != this->impostorCache_.end()) {
+        this->impostorLru_.splice(this->impostorLru_.begin(), this->impostorLru_, it->second.lru);
+        if (it->second.stamp == stamp) {
+            return it->second.target.color();
+        }
+        this->changed_ = true;
+    } else {
+        // reuse the least recently used impostor's framebuffer once the cache is full
+        std::optional<gfx::Framebuffer> target;
+        if (this->impostorCache_.size() >= IMPOSTOR_BUDGET) {
+            auto lru = this->impostorLru_.end();
+            while (lru != this->impostorLru_.begin()) {
+                auto& candidate = this->impostorCache_.at(*--lru);
+                if (!candidate.pinned && candidate.frame != this->impostorFrame_) {
+                    auto evicted = this->impostorCache_.find(*lru);
+                    target.emplace(std::move(evicted->second.target));
+                    this->impostorCache_.erase(evicted);
+                    this->impostorLru_.erase(lru);
+                    break;
+                }
+            }
+        }
+        // the cache isn't full, or everything in it is still in use, see TileMapRenderer::draw
+        if (!target) {
+            target.emplace(IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+        }
+        this->impostorLru_.push_front(key);
+        it = this->impostorCache_
+                 .emplace(key, Impostor { std::move(*target), 0, this->impostorLru_.begin(), false, 0 })
+                 .first;
+    }
+    // references to unordered_map elements stay valid, even if rendering dependencies inserts more impostors
+    auto& impostor = it->second;
+    impostor.stamp = stamp;
+    impostor.pinned = true;
+
+    float size = (float)(tilemap.tileSize() * TileMap::CHUNK_SIZE * (1u << (level - 1)));
+    glm::vec4 area = { x * size, y * size, (x + 1) * size, (y + 1) * size };
+    std::vector<gfx::Renderer::TexturedQuadCommand> commands;
+    std::array<Impostor*, 4> children = {};
+    if (level == 1) {
+        // the chunk's tiles, which are rendered right away, so only their pages have to be resident
+        this->staging_.clear();
+        this->collect(tilemap, x, y, this->staging_, this->mixed_);
+        if (!this->staging_.empty()) {
+            this->pages_->begin();
+            if (!this->requirePages(tilemap, x, y)) {
+                // rendered again once the pages fit
+                impostor.stamp = UINT64_MAX;
+            }
+            commands.push_back({ nullptr,
+                nullptr,
+                0,
+                static_cast<uint32_t>(this->staging_.size()),
+                false,
+                this->animations_.get(),
+                this->pages_.get() });
+        }
+    } else {
+        // 2x2 impostors of the previous level, each covering a quarter
+        auto span = 1u << (level - 2);
+        glm::vec2 count = { (tilemap.chunkColumns() + span - 1) / span, (tilemap.chunkRows() + span - 1) / span };
+        glm::vec2 half = { size / 4.f, size / 4.f };
+        for (uint32_t i = 0; i < 4; ++i) {
+            auto childX = x * 2 + (i & 1), childY = y * 2 + (i >> 1);
+            if (childX < count.x && childY < count.y) {
+                // keep it from being evicted while its siblings are rendered
+                this->impostor(renderer, tilemap, level - 1, childX, childY);
+                children[i] = &this->impostorCache_.at((uint64_t)(level - 1) << 48 | (uint64_t)childY << 24 | childX);
+                children[i]->pinned = true;
+            }
+        }
+        this->staging_.clear();
+        for (uint32_t i = 0; i < 4; ++i) {
+            if (children[i] == nullptr)
+                continue;
+            glm::vec2 position = { area.x + (i & 1) * size / 2.f, area.y + (i >> 1) * size / 2.f };
+            commands.push_back(
+                { &children[i]->target.color(), nullptr, static_cast<uint32_t>(this->staging_.size()), 1 });
+            this->staging_.push_back({ position + half, half, { 0.f, 0.f, 1.f, 1.f }, 0.f, 0.f });
+        }
+    }
+    this->scratch_.upload(this->staging_.data(), this->staging_.size() * sizeof(gfx::Renderer::QuadInstance));
+    renderer.renderTo(impostor.target, area, this->scratch_, commands);
+
+    for (auto* child : children) {
+        if (child != nullptr)
+            child->pinned = false;
+    }
+    impostor.pinned = false;
+    return impostor.target.color();
+}
+
+uint64_t
+TileMapRenderer::stamp(const TileMap& tilemap, uint32_t level, uint32_t x, uint32_t y) const
+{
+    // chunk revisions only ever grow, so their sum changes whenever any of them does
+    auto span = 1u << (level - 1);
+    auto lastX = std::min((x + 1) * span, tilemap.chunkColumns());
+    auto lastY = std::min((y + 1) * span, tilemap.chunkRows());
+    uint64_t stamp = 0;
+    for (auto chunkY = y * span; chunkY < lastY; ++chunkY) {
+        for (auto chunkX = x * span; chunkX < lastX; ++chunkX) {
+            stamp += tilemap.chunkRevision(chunkX, chunkY);
+        }
+    }
+    return stamp;
+}
+
+void
+TileMapRenderer::drawTileIndex(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible)
+{
+    auto chunkColumns = tilemap.chunkColumns();
+    auto chunkRows = tilemap.chunkRows();
+    auto& tiles = tilemap.tiles();
+
+    if (this->tiles_ == nullptr) {
+        this->tiles_ = std::make_unique<gfx::Image>(GL_TEXTURE_2D, tilemap.columns(), tilemap.rows(), 1, GL_R16UI);
+        this->tiles_->write(
+            0, 0, tilemap.columns(), tilemap.rows(), GL_RED_INTEGER, GL_UNSIGNED_SHORT, tiles.data(), tilemap.columns());
+        this->tileRevisions_.resize(chunkColumns * chunkRows);
+        for (uint32_t chunkY = 0; chunkY < chunkRows; ++chunkY) {
+            for (uint32_t chunkX = 0; chunkX < chunkColumns; ++chunkX) {
+                this->tileRevisions_[chunkX + chunkY * chunkColumns] = tilemap.chunkRevision(chunkX, chunkY);
+            }
+        }
+    }
+
+    // re-upload only the chunks which were edited, wherever they are
+    for (uint32_t chunkY = 0; chunkY < chunkRows; ++chunkY) {
+        for (uint32_t chunkX = 0; chunkX < chunkColumns; ++chunkX) {
+            auto& revision = this->tileRevisions_[chunkX + chunkY * chunkColumns];
+            if (revision == tilemap.chunkRevision(chunkX, chunkY))
+                continue;
+            revision = tilemap.chunkRevision(chunkX, chunkY);
+            this->changed_ = true;
+
+            auto column = chunkX * TileMap::CHUNK_SIZE;
+            auto row = chunkY * TileMap::CHUNK_SIZE;
+            auto width = std::min(TileMap::CHUNK_SIZE, tilemap.columns() - column);
+            auto height = std::min(TileMap::CHUNK_SIZE, tilemap.rows() - row);
+            this->tiles_->write(column,
+                row,
+                width,
+                height,
+                GL_RED_INTEGER,
+                GL_UNSIGNED_SHORT,
+                &tiles[column + row * tilemap.columns()],
+                tilemap.columns());
+        }
+    }
+
+    // only visible tiles are sampled, so only their pages have to be resident
+    auto range = visible_chunks(tilemap, visible);
+    this->pages_->begin();
+    for (auto chunkY = range.y; chunkY < range.w; ++chunkY) {
+        for (auto chunkX = range.x; chunkX < range.z; ++chunkX) {
+            this->requirePages(tilemap, chunkX, chunkY);
+        }
+    }
+
+    renderer.submit(gfx::Renderer::TileLayerCommand { this->tiles_.get(),
+        this->pages_.get(),
+        { 0.f, 0.f },
+        (float)tilemap.tileSize(),
+        this->tilesPerRow_,
+        this->animations_.get(),
+        this->animatedTiles_.get() });
+}
+
+void
+TileMapRenderer::rebuildTilesets(const TileMap& tilemap)
+{
+    // one layer per tileset id, as large as the largest atlas, palette indices if all atlases are
+    int width = 0, height = 0, layers = 0;
+    bool indexed = true;
+    auto& tilesets = tilemap.tilesets();
+    for (size_t id = 0; id < tilesets.size(); ++id) {
+        if (tilesets[id] == nullptr)
+            continue;
+        width = std::max(width, tilesets[id]->atlas().width());
+        height = std::max(height, tilesets[id]->atlas().height());
+        indexed &= tilesets[id]->atlas().indexed();
+        layers = (int)id + 1;
+    }
+    this->tilesPerRow_.fill(0);
+    this->tilesetsReady_ = true;
+    this->pagesMissing_ = false;
+    // the cache has to go before another one takes its memory
+    this->pages_.reset();
+    if (layers == 0) {
+        return;
+    }
+
+    // tiles are sampled at the mip level matching the zoom, though never at levels of less than a texel per tile
+    GLenum filter = this->mipmaps_ ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+    this->pages_ = std::make_unique<gfx::PageCache>(width,
+        height,
+        layers,
+        this->pageBudget_,
+        gfx::ImageOptions {
+            GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, filter, GL_NEAREST, indexed, false, (int)tilemap.tileSize() });
+    for (int id = 0; id < layers; ++id) {
+        if (tilesets[id] == nullptr)
+            continue;
+        auto& atlas = tilesets[id]->atlas();
+        // none of its pages are loaded until it's ready
+        if (!atlas.ready()) {
+            this->tilesetsReady_ = false;
+            continue;
+        }
+        if (indexed) {
+            this->pages_->copyPalette(id, atlas);
+        } else if (atlas.indexed()) {
+            this->paletteColors_[id] = atlas.palette()->pixels();
+        }
+        this->paletteRevisions_[id] = atlas.paletteRevision();
+        this->uvScales_[id] = { (float)atlas.width() / width, (float)atlas.height() / height };
+        this->tilesPerRow_[id] = atlas.width() / (int)tilemap.tileSize();
+    }
+}
+
+void
+TileMapRenderer::rebuildAnimations(const TileMap& tilemap)
+{
+    this->animations_.reset();
+    this->animatedTiles_.reset();
+    this->animationRows_.clear();
+    this->animationEnds_.clear();
+    this->animationRevisions_.fill(0);
+
+    // a row per animation, as wide as the longest one, and a row of tile ids per tileset
+    size_t width = 0, count = 0;
+    int layers = 0;
+    auto& tilesets = tilemap.tilesets();
+    for (size_t id = 0; id < tilesets.size() && id < this->animationRevisions_.size(); ++id) {
+        if (tilesets[id] == nullptr)
+            continue;
+        this->animationRevisions_[id] = tilesets[id]->animationRevision();
+        for (const auto& [tile, frames] : tilesets[id]->animations()) {
+            width = std::max(width, frames.size() + 1);
+            count++;
+        }
+        layers = (int)id + 1;
+    }
+    this->animationFrames_.assign(count, 0);
+    if (count == 0) {
+        return;
+    }
+
+    // see animation.glsl, frames are looked up by tile id in tile layers and by uv in chunks
+    std::vector<glm::vec4> table(width * count, glm::vec4(0.f));
+    this->animationRows_.assign((size_t)layers << 10, 0);
+    uint16_t row = 0;
+    for (int id = 0; id < layers; ++id) {
+        if (tilesets[id] == nullptr)
+            continue;
+        for (const auto& [tile, frames] : tilesets[id]->animations()) {
+            auto* texels = &table[row * width];
+            std::vector<uint32_t> ends;
+            uint32_t end = 0;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                Tile frame = 0;
+                TileSetId(frame, (uint16_t)id);
+                TileId(frame, frames[i].tile);
+                auto uv = tilemap.uv(frame) * glm::vec4(this->uvScales_[id], this->uvScales_[id]);
+                end += frames[i].duration;
+                ends.push_back(end);
+                texels[i + 1] = { (float)frames[i].tile, (float)end, uv.x, uv.y };
+            }
+            texels[0] = { (float)frames.size(), (float)end, 0.f, 0.f };
+            this->animationEnds_.push_back(std::move(ends));
+            this->animationRows_[(size_t)id << 10 | tile] = ++row;
+        }
+    }
+
+    this->animations_ = std::make_unique<gfx::Image>(GL_TEXTURE_2D, (int)width, (int)count, 1, GL_RGBA32F);
+    this->animations_->write(0, 0, (int)width, (int)count, GL_RGBA, GL_FLOAT, table.data(), (int)width);
+    this->animatedTiles_ = std::make_unique<gfx::Image>(GL_TEXTURE_2D, 1 << 10, layers, 1, GL_R16UI);
+    this->animatedTiles_->write(
+        0, 0, 1 << 10, layers, GL_RED_INTEGER, GL_UNSIGNED_SHORT, this->animationRows_.data(), 1 << 10);
+}
+
+void
+TileMapRenderer::rebuild(const TileMap& tilemap)
+{
+    if (this->pending_.empty()) {
+        return;
+    }
+
+    // split the pending chunks into contiguous bands, one per thread
+    auto bands = std::min(this->pending_.size(), this->workers_.threads());
+    this->bands_.resize(std::max(this->bands_.size(), bands));
+    auto chunkColumns = tilemap.chunkColumns();
+    this->workers_.run(bands, [&](size_t index) {
+        auto& band = this->bands_[index];
+        band.instances.clear();
+        band.chunks.clear();
+        auto first = this->pending_.size() * index / bands;
+        auto last = this->pending_.size() * (index + 1) / bands;
+        for (auto i = first; i < last; ++i) {
+            auto chunk = this->pending_[i];
+            auto offset = static_cast<uint32_t>(band.instances.size());
+            auto opaque = this->collect(tilemap, chunk % chunkColumns, chunk / chunkColumns, band.instances, band.mixed);
+            band.chunks.push_back({ chunk, offset, opaque, static_cast<uint32_t>(band.instances.size()) - offset });
+        }
+    });
+
+    // GL calls have to stay on this thread
+    for (size_t index = 0; index < bands; ++index) {
+        auto& band = this->bands_[index];
+        for (auto [i, offset, opaque, count] : band.chunks) {
+            auto& chunk = this->chunks_[i];
+            auto mixed = count - opaque;
+
+            // every tileset is paged in from the same cache, so the whole chunk is one command per opacity
+            chunk.commands.clear();
+            if (opaque > 0) {
+                chunk.commands.push_back(
+                    { nullptr, nullptr, 0, opaque, true, this->animations_.get(), this->pages_.get() });
+            }
+            if (mixed > 0) {
+                chunk.commands.push_back(
+                    { nullptr, nullptr, opaque, mixed, false, this->animations_.get(), this->pages_.get() });
+            }
+            chunk.instances.upload(band.instances.data() + offset, count * sizeof(gfx::Renderer::QuadInstance));
+            chunk.revision = tilemap.chunkRevision(i % chunkColumns, i / chunkColumns);
+            chunk.built = true;
+        }
+    }
+}
+
+bool
+TileMapRenderer::requirePages(const TileMap& tilemap, uint32_t chunkX, uint32_t chunkY)
+{
+    const int PAGE_SIZE = gfx::PageCache::PAGE_SIZE;
+    auto chunkColumns = tilemap.chunkColumns();
+    if (this->chunkPages_.empty()) {
+        this->chunkPages_.resize(chunkColumns * tilemap.chunkRows(), ChunkPages { {}, 0, false });
+    }
+
+    auto& chunk = this->chunkPages_[chunkX + chunkY * chunkColumns];
+    auto revision = tilemap.chunkRevision(chunkX, chunkY);
+    if (!chunk.built || chunk.revision != revision) {
+        chunk.pages.clear();
+        int tileSize = (int)tilemap.tileSize();
+        // pages covered by a tile, laid out like TileMap::uv, clipped to its atlas
+        auto cover = [&](uint16_t id, const TileSet& tileset, uint16_t tileId) {
+            auto perRow = this->tilesPerRow_[id];
+            if (perRow == 0)
+                return;
+            int left = (tileId / perRow) * tileSize, bottom = (tileId % perRow) * tileSize;
+            int right = std::min(left + tileSize, tileset.atlas().width()) - 1;
+            int top = std::min(bottom + tileSize, tileset.atlas().height()) - 1;
+            for (int y = bottom / PAGE_SIZE; y <= top / PAGE_SIZE; ++y) {
+                for (int x = left / PAGE_SIZE; x <= right / PAGE_SIZE; ++x) {
+                    chunk.pages.push_back((uint64_t)id << 40 | (uint64_t)y << 20 | (uint64_t)x);
+                }
+            }
+        };
+        auto lastColumn = std::min((chunkX + 1) * TileMap::CHUNK_SIZE, tilemap.columns());
+        auto lastRow = std::min((chunkY + 1) * TileMap::CHUNK_SIZE, tilemap.rows());
+        for (auto row = chunkY * TileMap::CHUNK_SIZE; row < lastRow; ++row) {
+            for (auto column = chunkX * TileMap::CHUNK_SIZE; column < lastColumn; ++column) {
+                auto tile = tilemap(column, row);
+                auto* tileset = tilemap.tileset(tile);
+                if (tileset == nullptr)
+                    continue;
+                // animated tiles show any of their frames
+                auto id = TileSetId(tile);
+                if (tile < this->animationRows_.size() && this->animationRows_[tile] != 0) {
+                    for (const auto& frame : tileset->animations().at(TileId(tile))) {
+                        cover(id, *tileset, frame.tile);
+                    }
+                } else {
+                    cover(id, *tileset, TileId(tile));
+                }
+            }
+        }
+        std::sort(chunk.pages.begin(), chunk.pages.end());
+        chunk.pages.erase(std::unique(chunk.pages.begin(), chunk.pages.end()), chunk.pages.end());
+        chunk.revision = revision;
+        chunk.built = true;
+    }
+
+    bool resident = true;
+    for (auto page : chunk.pages) {
+        auto id = (int)(page >> 40), y = (int)(page >> 20 & 0xFFFFF), x = (int)(page & 0xFFFFF);
+        resident &= this->pages_->require(
+            id, x, y, [&](uint8_t* texels) { this->loadPage(tilemap, id, x, y, texels); });
+    }
+    if (!resident) {
+        // missing pages are drawn as placeholders, which cached images of the scene mustn't keep
+        this->changed_ = true;
+        if (!this->pagesMissing_) {
+            spdlog::warn("Tileset pages of the visible tiles don't fit into the page budget of {} bytes",
+                this->pageBudget_);
+            this->pagesMissing_ = true;
+        }
+    }
+    return resident;
+}
+
+void
+TileMapRenderer::loadPage(const TileMap& tilemap, int id, int x, int y, uint8_t* texels) const
+{
+    const int PAGE_SIZE = gfx::PageCache::PAGE_SIZE;
+    auto& atlas = tilemap.tilesets()[id]->atlas();
+    auto* data = atlas.data();
+    // pages at the edges of the atlas only partially cover it, tiles never reach into the rest of the page
+    int left = x * PAGE_SIZE, bottom = y * PAGE_SIZE;
+    int width = std::min(PAGE_SIZE, atlas.width() - left), height = std::min(PAGE_SIZE, atlas.height() - bottom);
+    if (data == nullptr || width <= 0 || height <= 0) {
+        return;
+    }
+    auto stride = (size_t)atlas.width();
+    if (atlas.indexed() == this->pages_->indexed()) {
+        auto pixelSize = atlas.indexed() ? 1 : 4;
+        for (int row = 0; row < height; ++row) {
+            std::memcpy(texels + (size_t)row * PAGE_SIZE * pixelSize,
+                data + ((size_t)left + (size_t)(bottom + row) * stride) * pixelSize,
+                (size_t)width * pixelSize);
+        }
+        return;
+    }
+
+    // an indexed atlas among RGBA ones, its colors are looked up here
+    auto& colors = this->paletteColors_[id];
+    for (int row = 0; row < height; ++row) {
+        for (int column = 0; column < width; ++column) {
+            auto index = data[(size_t)(left + column) + (size_t)(bottom + row) * stride];
+            std::memcpy(&texels[((size_t)column + (size_t)row * PAGE_SIZE) * 4], &colors[(size_t)index * 4], 4);
+        }
+    }
+}
+
+uint32_t
+TileMapRenderer::collect(const TileMap& tilemap,
+    uint32_t chunkX,
+    uint32_t chunkY,
+    std::vector<gfx::Renderer::QuadInstance>& out,
+    std::vector<gfx::Renderer::QuadInstance>& mixed) const
+{
+    // TODO: center camera on tilemap instead of centering tilemap on camera.
+    float tileSize = (float)tilemap.tileSize();
+    float halfTileSize = tileSize / 2.f;
+    glm::vec2 tileScale = { halfTileSize, halfTileSize };
+
+    auto firstColumn = chunkX * TileMap::CHUNK_SIZE;
+    auto firstRow = chunkY * TileMap::CHUNK_SIZE;
+    auto lastColumn = std::min(firstColumn + TileMap::CHUNK_SIZE, tilemap.columns());
+    auto lastRow = std::min(firstRow + TileMap::CHUNK_SIZE, tilemap.rows());
+
+    auto first = out.size();
+    mixed.clear();
+    for (auto row = firstRow; row < lastRow; ++row) {
+        for (auto column = firstColumn; column < lastColumn; ++column) {
+            auto tile = tilemap(column, row);
+            if (tilemap.tileset(tile) == nullptr)
+                continue;
+            auto opacity = tilemap.opacity(tile);
+            if (opacity == Opacity::Transparent)
+                continue;
+            auto id = TileSetId(tile);
+            auto uv = tilemap.uv(tile) * glm::vec4(this->uvScales_[id], this->uvScales_[id]);
+            // tiles are laid out like the rows, by tileset id and tile id
+            float animation = tile < this->animationRows_.size() ? this->animationRows_[tile] : 0.f;
+            (opacity == Opacity::Opaque ? out : mixed)
+                .push_back({ { halfTileSize + column * tileSize, halfTileSize + row * tileSize },
+                    tileScale,
+                    uv,
+                    (float)id,
+                    animation });
+        }
+    }
+    auto opaque = static_cast<uint32_t>(out.size() - first);
+    out.insert(out.end(), mixed.begin(), mixed.end());
+    return opaque;
+}
+
+} // namespace tile
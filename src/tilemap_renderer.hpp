@@ -0,0 +1,235 @@
+#include "pch.h"
+
+#ifndef TEDIT_TILEMAP_RENDERER_
+#define TEDIT_TILEMAP_RENDERER_
+
+#include "gfx/renderer.hpp"
+#include "gfx/instance.hpp"
+#include "gfx/framebuffer.hpp"
+#include "gfx/page_cache.hpp"
+#include "thread_pool.hpp"
+
+namespace tile {
+
+class TileMap;
+
+/**
+ * Keeps the tiles of a TileMap on the GPU, in one of two ways:
+ * - Mode::Chunks splits the map into chunks of TileMap::CHUNK_SIZE x TileMap::CHUNK_SIZE instanced quads.
+ *   A chunk is only rebuilt when a tile inside of it changes, otherwise drawing it is a single draw command.
+ * - Mode::TileIndex uploads the tiles themselves into an integer texture, and draws the whole map as one
+ *   full-screen pass, so the cost only depends on the screen resolution. Edited chunks are re-uploaded.
+ *
+ * When zoomed out in Mode::Chunks, tiles are replaced by impostors: pre-rendered images of whole areas of the map,
+ * arranged like a mip chain. An impostor of level 1 covers a single chunk, each following level covers 2x2 impostors
+ * of the previous one at the same resolution. The level is picked so that an impostor texel is about a screen pixel.
+ * Impostors are kept in an LRU cache, and re-rendered when a chunk they cover changes.
+ *
+ * Whenever tiles which were already drawn change, the renderer's scene cache is invalidated.
+ *
+ * When many chunks have to be rebuilt at once, e.g. after loading a large map, their instances are generated on
+ * worker threads, each handling a band of chunk rows. The buffers are then uploaded on the GL thread.
+ *
+ * Tiles of tilesets which are still loading are left out, everything is rebuilt once all of them are ready.
+ *
+ * Tilesets are drawn from a gfx::PageCache with a layer per tileset, so atlases of any size fit into a fixed budget
+ * of texture memory. The pages each chunk's tiles cover are listed when it's first drawn, and those of all visible
+ * chunks are required before drawing them, or those of a single chunk before rendering its impostor.
+ * Pages are loaded from the atlas pixels kept in memory, see gfx::ImageOptions::keepPixels. Only texture memory is
+ * bounded, every atlas stays in system memory in full, e.g. 4 GiB for a 32768x32768 RGBA one, a quarter if indexed.
+ * If an indexed atlas is among RGBA ones, its colors are looked up while loading its pages, and a palette swap
+ * reloads them.
+ * Zoomed out, RGBA tiles are sampled from the pages' mip levels instead, which alias far less and read far fewer
+ * texels. Levels stop at a texel per tile, so they never blend neighboring tiles, see gfx::ImageOptions::tileSize.
+ * If all tilesets are palette-indexed, so are the pages, and palette swaps only update the cache's palette.
+ *
+ * Animated tiles are played on the GPU: instances and tile index texels refer to a row of a small table holding
+ * the frames of all animations, and shaders pick the current frame by the renderer's time, see gfx::Renderer::time.
+ * So playing animations never touches the tiles, the scene cache is only invalidated when a frame changes.
+ * Impostors keep the frames they were rendered with.
+ */
+class TileMapRenderer
+{
+public:
+    enum class Mode
+    {
+        Chunks,
+        TileIndex
+    };
+
+    // resolution of an impostor, in texels per side
+    static const int IMPOSTOR_SIZE = 256;
+    static const uint32_t IMPOSTOR_LEVELS = 8;
+    // maximum number of cached impostors
+    static const size_t IMPOSTOR_BUDGET = 256;
+    // texture memory for tileset pages, see setPageBudget
+    static const size_t DEFAULT_PAGE_BUDGET = 64 << 20;
+
+    TileMapRenderer();
+    TileMapRenderer(const TileMapRenderer& other) = delete;
+    TileMapRenderer& operator=(const TileMapRenderer& other) = delete;
+
+    /**
+     * Submit chunks intersecting `visible` to `renderer`, rebuilding those which changed since they were last drawn.
+     * @param visible world space rectangle as { left, bottom, right, top }, see gfx::Camera::visible
+     * @param zoom screen pixels per world unit, see gfx::Camera::zoom
+     */
+    void draw(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible, float zoom);
+
+    void setMode(Mode mode);
+    Mode mode() const;
+    void setImpostors(bool enabled);
+    /**
+     * Bytes of texture memory resident tileset pages may take up, regardless of the size of the atlases.
+     * The atlases themselves are kept in system memory in full.
+     * If the pages of all visible tiles don't fit, some of them are drawn as a grey placeholder.
+     */
+    void setPageBudget(size_t bytes);
+    /**
+     * Whether zoomed out tiles are sampled from mip levels, rather than skipping texels. Enabled by default.
+     */
+    void setMipmaps(bool enabled);
+    /**
+     * Time from the last draw until an animated tile shows its next frame, or nothing if no tile is animated.
+     */
+    std::optional<std::chrono::milliseconds> nextAnimationFrame() const;
+
+private:
+    struct Chunk
+    {
+        gfx::InstanceBuffer instances;
+        // empty if the chunk has no tiles, otherwise a single command
+        std::vector<gfx::Renderer::TexturedQuadCommand> commands;
+        uint32_t revision;
+        // chunks are built lazily, the first time they are visible
+        bool built;
+    }; // struct Chunk
+
+    struct Impostor
+    {
+        gfx::Framebuffer target;
+        // sum of the revisions of all chunks it covers, at the time it was rendered
+        uint64_t stamp;
+        std::list<uint64_t>::iterator lru;
+        // set while it or its parent is being rendered, so that it can't be evicted
+        bool pinned;
+        // `impostorFrame_` when it was last submitted, it can't be evicted before the next frame either
+        uint64_t frame;
+    }; // struct Impostor
+
+    // atlas pages the tiles of a chunk are drawn from, as layer << 40 | y << 20 | x
+    struct ChunkPages
+    {
+        std::vector<uint64_t> pages;
+        uint32_t revision;
+        bool built;
+    }; // struct ChunkPages
+
+    // instances generated by one thread for a band of chunks
+    struct Band
+    {
+        std::vector<gfx::Renderer::QuadInstance> instances;
+        std::vector<gfx::Renderer::QuadInstance> mixed;
+        // per chunk: index into `chunks_`, first instance, opaque instances, all instances
+        std::vector<std::array<uint32_t, 4>> chunks;
+    }; // struct Band
+
+    void drawChunks(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible);
+    void drawImpostors(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible, uint32_t level);
+    /**
+     * Get the impostor at (x, y) of `level`, rendering it first if it's missing or stale.
+     */
+    const gfx::Image& impostor(gfx::Renderer& renderer, const TileMap& tilemap, uint32_t level, uint32_t x, uint32_t y);
+    uint64_t stamp(const TileMap& tilemap, uint32_t level, uint32_t x, uint32_t y) const;
+    void drawTileIndex(gfx::Renderer& renderer, const TileMap& tilemap, glm::vec4 visible);
+    /**
+     * Make the pages of a chunk's tiles resident until the next gfx::PageCache::begin, see `chunkPages_`.
+     * @return false if some of them don't fit into the budget
+     */
+    bool requirePages(const TileMap& tilemap, uint32_t chunkX, uint32_t chunkY);
+    /**
+     * Write page (x, y) of the atlas of tileset `id` to `texels`, see gfx::PageCache::Loader.
+     */
+    void loadPage(const TileMap& tilemap, int id, int x, int y, uint8_t* texels) const;
+    void rebuildTilesets(const TileMap& tilemap);
+    /**
+     * Rebuild the animation tables from the animations of all tilesets, after Renderer::rebuildTilesets.
+     */
+    void rebuildAnimations(const TileMap& tilemap);
+    /**
+     * Rebuild the chunks in `pending_`.
+     */
+    void rebuild(const TileMap& tilemap);
+    /**
+     * Append the instances of a chunk's tiles to `out`, opaque tiles first. Transparent tiles are skipped.
+     * Safe to call from any thread.
+     * @param mixed scratch space
+     * @return the number of opaque tiles
+     */
+    uint32_t collect(const TileMap& tilemap,
+        uint32_t chunkX,
+        uint32_t chunkY,
+        std::vector<gfx::Renderer::QuadInstance>& out,
+        std::vector<gfx::Renderer::QuadInstance>& mixed) const;
+
+    Mode mode_;
+    bool impostors_;
+    // tiles which were already drawn changed, see gfx::Renderer::invalidateScene
+    bool changed_;
+    uint64_t revision_;
+    // whether all tilesets were ready when `pages_` was built
+    bool tilesetsReady_;
+    std::vector<Chunk> chunks_;
+    // Mode::TileIndex, one texel per tile
+    std::unique_ptr<gfx::Image> tiles_;
+    // Mode::TileIndex, chunk revisions which are uploaded to `tiles_`
+    std::vector<uint32_t> tileRevisions_;
+    // all tilesets of the map, each tileset atlas is paged in from the layer matching its TileSetId
+    std::unique_ptr<gfx::PageCache> pages_;
+    size_t pageBudget_;
+    bool mipmaps_;
+    // per chunk, listed when the chunk is first drawn after it changed
+    std::vector<ChunkPages> chunkPages_;
+    // whether pages were missing since `pages_` was built, which is only logged once
+    bool pagesMissing_;
+    // atlases smaller than a layer only cover part of it, their UVs are scaled by this
+    std::array<glm::vec2, 1 << 6> uvScales_;
+    // tiles per atlas row of each tileset, 0 if there's no tileset with that id
+    std::array<int, 1 << 6> tilesPerRow_;
+    // palette revision of each tileset's atlas when its colors were copied to `pages_`, or to `paletteColors_`
+    std::array<uint32_t, 1 << 6> paletteRevisions_;
+    // if `pages_` is RGBA, the palette of each indexed atlas, which its pages are looked up in as they're loaded
+    std::array<std::vector<uint8_t>, 1 << 6> paletteColors_;
+    // see gfx::Renderer::TileLayerCommand::animations and animatedTiles, both are empty if no tile is animated
+    std::unique_ptr<gfx::Image> animations_;
+    std::unique_ptr<gfx::Image> animatedTiles_;
+    // 1 + the row of each tile's animation, indexed by the tile itself, or 0 if it isn't animated
+    std::vector<uint16_t> animationRows_;
+    // per animation, the time each frame ends at, and the frame it showed when last drawn
+    std::vector<std::vector<uint32_t>> animationEnds_;
+    std::vector<size_t> animationFrames_;
+    std::array<uint32_t, 1 << 6> animationRevisions_;
+    std::optional<std::chrono::milliseconds> nextAnimationFrame_;
+    // impostors by level | y | x, and their keys from the most to the least recently used
+    std::unordered_map<uint64_t, Impostor> impostorCache_;
+    std::list<uint64_t> impostorLru_;
+    // incremented by every drawImpostors, see Impostor::frame
+    uint64_t impostorFrame_;
+    ThreadPool workers_;
+    // indices of chunks to rebuild this frame, in row order
+    std::vector<uint32_t> pending_;
+    std::vector<Band> bands_;
+    // scratch space for impostor rebuilds
+    std::vector<gfx::Renderer::QuadInstance> staging_;
+    std::vector<gfx::Renderer::QuadInstance> mixed_;
+    // instances of an impostor being rendered
+    gfx::InstanceBuffer scratch_;
+    // visible impostors, one quad and command each
+    std::vector<gfx::Renderer::QuadInstance> visibleImpostors_;
+    std::vector<gfx::Renderer::TexturedQuadCommand> impostorCommands_;
+    gfx::InstanceBuffer impostorInstances_;
+}; // class TileMapRenderer
+
+} // namespace tile
+
+#endif // TEDIT_TILEMAP_RENDERER_
@@ -446,8 +446,16 @@ Render_TilesetDisplayWindow(Context* context, ImGuiIO& io)
                 // TODO: investigate a cleaner solution
                 auto tileset_p0 = ImVec2(origin.x, origin.y - (currentTileSetAtlas.height() / zoom) + display_sz.y);
                 auto tileset_p1 = ImVec2(origin.x + (currentTileSetAtlas.width() / zoom), origin.y + display_sz.y);
-                draw_list->AddImage(
-                    (void*)(currentTileSetAtlas.handle()), tileset_p0, tileset_p1, ImVec2(0, 1), ImVec2(1, 0));
+                if (currentTileSetAtlas.ready() && currentTileSet->preview().handle() != 0) {
+                    draw_list->AddImage((void*)(currentTileSet->preview().handle()),
+                        tileset_p0,
+                        tileset_p1,
+                        ImVec2(0, 1),
+                        ImVec2(1, 0));
+                } else {
+                    // still loading
+                    draw_list->AddRectFilled(tileset_p0, tileset_p1, IM_COL32(128, 128, 128, 255));
+                }
 
                 // Get the currently hovered + active tile
                 // And set the current tile on click
@@ -478,10 +486,12 @@ Render_TilesetDisplayWindow(Context* context, ImGuiIO& io)
                             // @AddImage)
                             auto tile_id = tile_row + tile_column * tilesPerRow;
 
-                            // set current tile
-                            state.currentTile = 0;
-                            tile::TileSetId(state.currentTile, state.tileSetIndex);
-                            tile::TileId(state.currentTile, tile_id);
+                            // set current tile, tiles past the ones a Tile can address can't be placed
+                            if (tile_id < tile::TILE_IDS) {
+                                state.currentTile = 0;
+                                tile::TileSetId(state.currentTile, state.tileSetIndex);
+                                tile::TileId(state.currentTile, tile_id);
+                            }
                         }
                     }
                 }
@@ -593,6 +603,27 @@ Render_EditorMenuBar(Context* context)
             }
             ImGui::EndMenu();
         }
+
+        // Renderer settings
+        if (ImGui::BeginMenu("Render")) {
+            ImGui::MenuItem("Persistent buffers", NULL, &state.render.persistentBuffers);
+            ImGui::MenuItem("Tile index texture", NULL, &state.render.tileIndexTexture);
+            ImGui::MenuItem("Zoomed out impostors", NULL, &state.render.impostors);
+            ImGui::MenuItem("Tileset mipmaps", NULL, &state.render.mipmaps);
+            ImGui::MenuItem("Cache map view", NULL, &state.render.sceneCache);
+            ImGui::MenuItem("Opaque tiles pass", NULL, &state.render.opaquePass);
+            ImGui::Separator();
+            ImGui::MenuItem("Continuous redraw", NULL, &state.render.continuous);
+            ImGui::MenuItem("Low latency painting", NULL, &state.render.lowLatency);
+            ImGui::Separator();
+            ImGui::Text("Blended samples: %llu", (unsigned long long)state.renderStats.blendedSamples);
+            ImGui::Text("Opaque samples: %llu", (unsigned long long)state.renderStats.opaqueSamples);
+            ImGui::Text("Input latency: %.1f ms, average %.1f ms, max %.1f ms",
+                state.renderStats.inputLatency,
+                state.renderStats.inputLatencyAverage,
+                state.renderStats.inputLatencyMax);
+            ImGui::EndMenu();
+        }
         ImGui::EndMainMenuBar();
     }
 }
@@ -729,6 +760,10 @@ Context::render()
 
     this->state_.hasMouseFocus = io.WantCaptureMouse;
     this->state_.hasKeyboardFocus = io.WantCaptureKeyboard;
+    // widgets being dragged or typed into keep changing without new input, e.g. the text cursor blinks
+    if (ImGui::IsAnyItemActive()) {
+        this->window_->invalidate();
+    }
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -815,6 +850,8 @@ void
 Context::microtask(Task&& task)
 {
     this->tasks_.enqueue(std::move(task));
+    // microtasks are queued from other threads, wake up the main loop to run them
+    this->window_->invalidate();
 }
 
 void
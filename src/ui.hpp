@@ -23,6 +23,42 @@ struct ConfirmDialog
     bool done = true;
 }; // struct ConfirmDialog
 
+/**
+ * Renderer settings, toggled from the Render menu and applied by the main loop every frame.
+ */
+struct RenderSettings
+{
+    bool persistentBuffers = true;
+    // draw the tile map from a tile index texture instead of chunks of quads
+    bool tileIndexTexture = false;
+    // replace tiles with pre-rendered impostors when zoomed out
+    bool impostors = true;
+    // sample zoomed out tiles from mip levels of their tilesets
+    bool mipmaps = true;
+    // keep the rendered map in an offscreen image, and only redraw what changed
+    bool sceneCache = true;
+    // draw opaque tiles front-to-back without blending, off as the extra pass costs more than it saves on llvmpipe
+    bool opaquePass = false;
+    // draw every frame, even when nothing changed, for profiling
+    bool continuous = false;
+    // present without vsync, frames paced by a frame limiter, see Window::Presentation::LowLatency
+    bool lowLatency = false;
+}; // struct RenderSettings
+
+/**
+ * Renderer measurements shown in the Render menu, updated by the main loop every frame.
+ */
+struct RenderStats
+{
+    // textured quad samples written with and without blending
+    uint64_t blendedSamples = 0;
+    uint64_t opaqueSamples = 0;
+    // milliseconds from input to the swap showing it, see Window::InputLatency
+    double inputLatency = 0;
+    double inputLatencyAverage = 0;
+    double inputLatencyMax = 0;
+}; // struct RenderStats
+
 struct ContextState
 {
     std::string tileMapPath;
@@ -36,6 +72,8 @@ struct ContextState
     bool interactionBlocked = false;
     std::string workingDirectory = {};
     std::string executableDirectory = {};
+    RenderSettings render = {};
+    RenderStats renderStats = {};
 }; // struct ContextState
 
 class Context
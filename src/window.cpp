@@ -2,11 +2,23 @@
 #include "pch.h"
 #include "window.hpp"
 #include "gfx/gl.h"
+#include "gfx/framebuffer.hpp"
 #include <portable-file-dialogs.h>
+#ifdef TEDIT_EGL
+// otherwise EGL's headers pull in Xlib, which headless machines may not even have
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // window instance for event listeners
 static Window* window = nullptr;
 
+// seconds a low latency frame is planned to be done before its deadline, to absorb jitter
+static const double FRAME_MARGIN = 0.001;
+// sleeping overshoots by up to a scheduler tick, so waiting for the last few milliseconds yields instead
+static const double SPIN_TIME = 0.002;
+
 static void GLAPIENTRY
 global_GLMessageCallback(GLenum source,
     GLenum type,
@@ -54,44 +66,86 @@ global_HandleGLFWScroll(GLFWwindow*, double xoffset, double yoffset)
     window->onScroll(xoffset, yoffset);
 }
 
+// window needs to be redrawn, but there's no input to handle
+static void
+global_HandleGLFWRefresh(GLFWwindow*)
+{
+    window->invalidate();
+}
+
+static void
+global_HandleGLFWFocus(GLFWwindow*, int)
+{
+    window->invalidate();
+}
+
+static void
+global_HandleGLFWChar(GLFWwindow*, unsigned int)
+{
+    window->invalidate();
+}
+
 static void
 onError(int error, const char* description)
 {
     spdlog::error("GLFW Error {}: {}", error, description);
 }
 
-Window::Window(const std::string& title, int width, int height)
+Window::Window(const std::string& title, int width, int height, Backend backend)
   : handle_(nullptr)
+  , backend_(backend)
+  , display_(nullptr)
+  , context_(nullptr)
+  , target_()
+  , closed_(false)
   , title_(title)
   , width_(width)
   , height_(height)
   , listeners_()
+  , invalidatedFrames_(INVALIDATED_FRAMES)
+  , deadline_(std::numeric_limits<double>::infinity())
+  , presentation_(Presentation::VSync)
+  , refreshPeriod_(1.0 / 60.0)
+  , frameDeadline_(0)
+  , frameStart_(0)
+  , frameEstimate_(0)
+  , inputTime_(std::numeric_limits<double>::infinity())
+  , latencies_()
+  , latencyCount_(0)
+  , inputLatency_()
   , dialogOpen_(false)
 {
-    glfwSetErrorCallback(onError);
-    assert(glfwInit());
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-    // sorry apple
-    // glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE)
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-
-    this->handle_ = glfwCreateWindow(this->width_, this->height_, this->title_.c_str(), NULL, NULL);
-    assert(this->handle_);
-
-    glfwSetCursorPosCallback(this->handle_, ::global_HandleGLFWMouseMove);
-    glfwSetMouseButtonCallback(this->handle_, ::global_HandleGLFWMouseButton);
-    glfwSetKeyCallback(this->handle_, ::global_HandleGLFWKey);
-    glfwSetScrollCallback(this->handle_, ::global_HandleGLFWScroll);
-    glfwSetFramebufferSizeCallback(this->handle_, ::global_HandleGLFWResize);
-
-    glfwMakeContextCurrent(this->handle_);
-    glfwSwapInterval(1); // Enable vsync
-
-    assert(gladLoadGLLoader((GLADloadproc)glfwGetProcAddress));
+    if (backend == Backend::Headless) {
+        this->createHeadless();
+    } else {
+        glfwSetErrorCallback(onError);
+        assert(glfwInit());
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        // sorry apple
+        // glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE)
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+        glfwWindowHint(GLFW_SAMPLES, 4);
+
+        this->handle_ = glfwCreateWindow(this->width_, this->height_, this->title_.c_str(), NULL, NULL);
+        assert(this->handle_);
+
+        glfwSetCursorPosCallback(this->handle_, ::global_HandleGLFWMouseMove);
+        glfwSetMouseButtonCallback(this->handle_, ::global_HandleGLFWMouseButton);
+        glfwSetKeyCallback(this->handle_, ::global_HandleGLFWKey);
+        glfwSetScrollCallback(this->handle_, ::global_HandleGLFWScroll);
+        glfwSetFramebufferSizeCallback(this->handle_, ::global_HandleGLFWResize);
+        glfwSetWindowRefreshCallback(this->handle_, ::global_HandleGLFWRefresh);
+        glfwSetWindowFocusCallback(this->handle_, ::global_HandleGLFWFocus);
+        glfwSetCharCallback(this->handle_, ::global_HandleGLFWChar);
+
+        glfwMakeContextCurrent(this->handle_);
+        glfwSwapInterval(1); // Presentation::VSync
+
+        assert(gladLoadGLLoader((GLADloadproc)glfwGetProcAddress));
+    }
 
     glDebugMessageCallback(global_GLMessageCallback, NULL);
 
@@ -99,9 +153,67 @@ Window::Window(const std::string& title, int width, int height)
     window = this;
 }
 
+void
+Window::createHeadless()
+{
+#ifdef TEDIT_EGL
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay == nullptr) {
+        throw std::runtime_error("EGL platform displays are not supported");
+    }
+    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        throw std::runtime_error(fmt::format("Failed to initialize EGL's surfaceless platform: {:#x}", eglGetError()));
+    }
+    this->display_ = display;
+    eglBindAPI(EGL_OPENGL_API);
+
+    // the same context as the windowed one, without a config as nothing is ever presented
+    const EGLint attributes[] = { EGL_CONTEXT_MAJOR_VERSION,
+        4,
+        EGL_CONTEXT_MINOR_VERSION,
+        5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        throw std::runtime_error(fmt::format("Failed to create a headless OpenGL 4.5 context: {:#x}", eglGetError()));
+    }
+    this->context_ = context;
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        throw std::runtime_error("Failed to load OpenGL functions");
+    }
+    spdlog::info("Headless EGL {}.{} context, {}", major, minor, (const char*)glGetString(GL_RENDERER));
+
+    // there is no default framebuffer to draw into
+    this->target_ = std::make_unique<gfx::Framebuffer>(this->width_, this->height_, true);
+    gfx::Framebuffer::SetScreen(this->target_->handle());
+    glViewport(0, 0, this->width_, this->height_);
+#else
+    throw std::runtime_error("Headless rendering is only available on Linux");
+#endif
+}
+
 Window::~Window()
 {
     std::unique_lock<std::mutex> lock(this->dialogMutex_);
+#ifdef TEDIT_EGL
+    if (this->backend_ == Backend::Headless) {
+        // the framebuffer belongs to the context
+        this->target_.reset();
+        gfx::Framebuffer::SetScreen(0);
+        if (this->display_ != nullptr) {
+            eglMakeCurrent(this->display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (this->context_ != nullptr) {
+                eglDestroyContext(this->display_, this->context_);
+            }
+            eglTerminate(this->display_);
+        }
+        return;
+    }
+#endif
     glfwDestroyWindow(this->handle_);
     glfwTerminate();
 }
@@ -109,25 +221,156 @@ Window::~Window()
 void
 Window::pollInput()
 {
+    if (this->handle_ != nullptr) {
+        glfwPollEvents();
+    }
+}
+
+void
+Window::waitInput(double timeout)
+{
+    // nothing to wait for without input
+    if (this->handle_ == nullptr) {
+        return;
+    }
+    if (this->invalidatedFrames_ > 0) {
+        glfwPollEvents();
+    }
+    while (this->invalidatedFrames_ <= 0 && !this->shouldClose()) {
+        auto now = glfwGetTime();
+        if (now >= this->deadline_) {
+            // nothing but the scene changed, ImGui doesn't need to settle
+            this->invalidatedFrames_ = 1;
+            break;
+        }
+        glfwWaitEventsTimeout(std::min(timeout, this->deadline_ - now));
+        if (this->invalidatedFrames_ <= 0) {
+            for (const auto& listener : this->listeners_.idle) {
+                if (listener()) {
+                    this->invalidate();
+                }
+            }
+        }
+    }
+    --this->invalidatedFrames_;
+    this->deadline_ = std::numeric_limits<double>::infinity();
+}
+
+void
+Window::invalidate()
+{
+    this->invalidatedFrames_ = INVALIDATED_FRAMES;
+    // wake up the main thread if it's blocked in glfwWaitEventsTimeout
+    if (this->handle_ != nullptr) {
+        glfwPostEmptyEvent();
+    }
+}
+
+void
+Window::invalidateIn(double delay)
+{
+    if (this->handle_ == nullptr) {
+        return;
+    }
+    this->deadline_ = std::min(this->deadline_, glfwGetTime() + delay);
+}
+
+void
+Window::setPresentation(Presentation presentation)
+{
+    if (this->handle_ == nullptr || presentation == this->presentation_) {
+        return;
+    }
+    this->presentation_ = presentation;
+    glfwSwapInterval(presentation == Presentation::VSync ? 1 : 0);
+    // frames are paced to the monitor the window is most likely on
+    if (auto* mode = glfwGetVideoMode(glfwGetPrimaryMonitor()); mode != nullptr && mode->refreshRate > 0) {
+        this->refreshPeriod_ = 1.0 / mode->refreshRate;
+    }
+    this->frameDeadline_ = 0;
+    this->frameStart_ = glfwGetTime();
+    spdlog::info("Presentation: {}, {:.1f} Hz",
+        presentation == Presentation::VSync ? "vsync" : "low latency",
+        1.0 / this->refreshPeriod_);
+}
+
+Window::Presentation
+Window::presentation() const
+{
+    return this->presentation_;
+}
+
+void
+Window::waitFrame()
+{
+    if (this->handle_ == nullptr || this->presentation_ != Presentation::LowLatency) {
+        return;
+    }
+    auto start = this->frameDeadline_ - this->frameEstimate_ - FRAME_MARGIN;
+    for (auto now = glfwGetTime(); now < start; now = glfwGetTime()) {
+        if (start - now > SPIN_TIME) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(start - now - SPIN_TIME));
+        } else {
+            std::this_thread::yield();
+        }
+    }
     glfwPollEvents();
+    this->frameStart_ = glfwGetTime();
 }
 
 void
 Window::close()
 {
+    if (this->handle_ == nullptr) {
+        this->closed_ = true;
+        return;
+    }
     glfwSetWindowShouldClose(this->handle_, GLFW_TRUE);
 }
 
 bool
 Window::shouldClose() const
 {
-    return glfwWindowShouldClose(this->handle_);
+    return this->handle_ == nullptr ? this->closed_ : glfwWindowShouldClose(this->handle_);
 }
 
 void
 Window::swapBuffers()
 {
+    if (this->handle_ == nullptr) {
+        // like a swap, the frame is done once this returns, e.g. to time it
+        glFinish();
+        return;
+    }
     glfwSwapBuffers(this->handle_);
+    this->measureFrame();
+}
+
+void
+Window::stampInput()
+{
+    this->inputTime_ = std::min(this->inputTime_, glfwGetTime());
+}
+
+void
+Window::measureFrame()
+{
+    auto now = glfwGetTime();
+    if (this->inputTime_ <= now) {
+        auto latency = now - this->inputTime_;
+        this->inputTime_ = std::numeric_limits<double>::infinity();
+        this->latencies_[this->latencyCount_++ % LATENCY_SAMPLES] = latency;
+        auto begin = this->latencies_.begin(), end = begin + std::min(this->latencyCount_, LATENCY_SAMPLES);
+        auto average = std::accumulate(begin, end, 0.0) / (double)(end - begin);
+        this->inputLatency_ = { latency, average, *std::max_element(begin, end) };
+    }
+
+    if (this->presentation_ == Presentation::LowLatency) {
+        auto frame = now - this->frameStart_;
+        this->frameEstimate_ = std::max(frame, this->frameEstimate_ + (frame - this->frameEstimate_) * 0.1);
+        // a frame which missed its deadline, or the first one after waiting for input, starts a new schedule
+        this->frameDeadline_ = std::max(this->frameDeadline_, now) + this->refreshPeriod_;
+    }
 }
 
 void
@@ -140,6 +383,12 @@ Window::openDialog(Dialog type,
     if (this->dialogOpen_) {
         return;
     }
+    // nobody could answer it
+    if (this->handle_ == nullptr) {
+        std::vector<std::string> selection;
+        callback(false, selection);
+        return;
+    }
 
     this->dialogOpen_ = true;
 
@@ -219,6 +468,9 @@ bool
 Window::shortcut(int modifier_val, int key)
 {
     auto modifiers = (Window::Modifier)modifier_val;
+    if (this->handle_ == nullptr) {
+        return false;
+    }
 
     if ((modifiers & Window::Modifier::CONTROL) &&
         !(glfwGetKey(this->handle_, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS ||
@@ -243,7 +495,9 @@ void
 Window::setTitle(const std::string& title)
 {
     this->title_ = title;
-    glfwSetWindowTitle(this->handle_, this->title_.c_str());
+    if (this->handle_ != nullptr) {
+        glfwSetWindowTitle(this->handle_, this->title_.c_str());
+    }
 }
 
 const std::string&
@@ -252,12 +506,30 @@ Window::title() const
     return this->title_;
 }
 
+Window::Backend
+Window::backend() const
+{
+    return this->backend_;
+}
+
 GLFWwindow*
 Window::handle() const
 {
     return this->handle_;
 }
 
+const gfx::Framebuffer*
+Window::target() const
+{
+    return this->target_.get();
+}
+
+const Window::InputLatency&
+Window::inputLatency() const
+{
+    return this->inputLatency_;
+}
+
 int
 Window::width() const
 {
@@ -300,9 +572,17 @@ Window::addResizeListener(std::function<void(int, int)> listener)
     this->listeners_.resize.emplace_back(listener);
 }
 
+void
+Window::addIdleListener(std::function<bool()> listener)
+{
+    this->listeners_.idle.emplace_back(listener);
+}
+
 void
 Window::onMouseMove(double xpos, double ypos)
 {
+    this->stampInput();
+    this->invalidate();
     for (const auto& listener : this->listeners_.mouseMove) {
         listener(xpos, ypos);
     }
@@ -311,6 +591,8 @@ Window::onMouseMove(double xpos, double ypos)
 void
 Window::onMouseButton(int button, int action, int modifiers)
 {
+    this->stampInput();
+    this->invalidate();
     for (const auto& listener : this->listeners_.mouseButton) {
         listener(button, action, modifiers);
     }
@@ -319,6 +601,8 @@ Window::onMouseButton(int button, int action, int modifiers)
 void
 Window::onKey(int key, int /* scancode */, int action, int modifiers)
 {
+    this->stampInput();
+    this->invalidate();
     for (const auto& listener : this->listeners_.key) {
         listener(key, action, modifiers);
     }
@@ -327,6 +611,8 @@ Window::onKey(int key, int /* scancode */, int action, int modifiers)
 void
 Window::onScroll(double xoffset, double yoffset)
 {
+    this->stampInput();
+    this->invalidate();
     for (const auto& listener : this->listeners_.scroll) {
         listener(xoffset, yoffset);
     }
@@ -338,6 +624,7 @@ Window::onResize(int width, int height)
     this->width_ = width;
     this->height_ = height;
     glViewport(0, 0, width, height);
+    this->invalidate();
 
     for (const auto& listener : this->listeners_.resize) {
         listener(width, height);
@@ -4,12 +4,53 @@
 
 struct GLFWwindow;
 
+namespace gfx {
+class Framebuffer;
+} // namespace gfx
+
 /**
- * GLFW RAII wrapper
+ * GLFW RAII wrapper, or a headless OpenGL context without any window, see Window::Backend.
  */
 class Window final
 {
 public:
+    enum class Backend
+    {
+        // a visible GLFW window
+        Windowed,
+        /**
+         * An EGL context on Mesa's surfaceless platform, which works without a display or a GPU, e.g. with llvmpipe.
+         * Everything is rendered into target() instead of a default framebuffer, see gfx::Framebuffer::Screen.
+         * There is no input, waitInput never blocks, and swapBuffers only waits for rendering to finish.
+         * Only available on Linux.
+         */
+        Headless
+    }; // enum class Backend
+
+    enum class Presentation
+    {
+        // swaps wait for vertical blank, tearing free and idle between frames, but input is shown frames late
+        VSync,
+        /**
+         * Swaps don't wait, frames are paced by a CPU frame limiter instead: waitFrame sleeps until just before the
+         * next frame has to start to be done by the next refresh, then picks up the input which came in meanwhile.
+         * Input is shown sooner, at the cost of tearing and a busier CPU.
+         */
+        LowLatency
+    }; // enum class Presentation
+
+    /**
+     * Time from input events to the swap of the first frame drawn after them, in seconds, see inputLatency.
+     * GLFW doesn't timestamp events, so they're stamped when dispatched, which misses time spent in the OS queue.
+     */
+    struct InputLatency
+    {
+        double last = 0;
+        // over the last LATENCY_SAMPLES frames showing input
+        double average = 0;
+        double max = 0;
+    }; // struct InputLatency
+
     enum class Dialog
     {
         OpenFile,
@@ -17,10 +58,43 @@ public:
         SelectFolder
     }; // enum class Dialog
 
-    Window(const std::string& title, int width, int height);
+    // frames drawn after each invalidation, ImGui only settles on hover and layout changes a frame later
+    static const int INVALIDATED_FRAMES = 3;
+    static const size_t LATENCY_SAMPLES = 120;
+
+    /**
+     * @throws std::runtime_error if a headless context can't be created
+     */
+    Window(const std::string& title, int width, int height, Backend backend = Backend::Windowed);
     ~Window();
 
     void pollInput();
+    /**
+     * Block until the window is invalidated, then process pending events.
+     * Wakes up every `timeout` seconds, so that the loop notices `shouldClose` even if nothing else happens, and to
+     * call the idle listeners.
+     */
+    void waitInput(double timeout);
+    /**
+     * Request new frames from a loop blocked in `waitInput`. Thread-safe.
+     * Input events invalidate the window on their own.
+     */
+    void invalidate();
+    /**
+     * Have the next `waitInput` return after at most `delay` seconds, e.g. because something animated changes then.
+     */
+    void invalidateIn(double delay);
+    /**
+     * VSync by default. Headless windows ignore this.
+     */
+    void setPresentation(Presentation presentation);
+    Presentation presentation() const;
+    /**
+     * With Presentation::LowLatency, sleep until the latest time the next frame can start and still be done by the
+     * next refresh, then process the events which came in meanwhile. Otherwise returns right away.
+     * Call right before reading input for a frame, so that it's as fresh as possible.
+     */
+    void waitFrame();
     void close();
     bool shouldClose() const;
     void swapBuffers();
@@ -45,7 +119,16 @@ public:
     bool shortcut(int modifiers, int key);
 
     const std::string& title() const;
+    Backend backend() const;
+    /**
+     * Null for headless windows.
+     */
     GLFWwindow* handle() const;
+    /**
+     * What a headless window renders into, e.g. to save it with gfx::Image::save. Null for other windows.
+     */
+    const gfx::Framebuffer* target() const;
+    const InputLatency& inputLatency() const;
     int width() const;
     int height() const;
 
@@ -69,6 +152,11 @@ public:
      * @param listener arguments are (width, height)
      */
     void addResizeListener(std::function<void(int, int)> listener);
+    /**
+     * Called whenever `waitInput` wakes up and the window isn't invalidated, to check for changes without drawing.
+     * @param listener returns whether the window has to be drawn again
+     */
+    void addIdleListener(std::function<bool()> listener);
 
     void onMouseMove(double xpos, double ypos);
     void onMouseButton(int button, int action, int modifiers);
@@ -77,11 +165,47 @@ public:
     void onResize(int width, int height);
 
 private:
+    void createHeadless();
+    /**
+     * Remember when the first input event since the last swap was dispatched, see `inputLatency`.
+     */
+    void stampInput();
+    /**
+     * After a swap, measure how long the input it shows took, and schedule the next frame.
+     */
+    void measureFrame();
+
     GLFWwindow* handle_;
+    Backend backend_;
+    // only for headless windows: EGLDisplay, EGLContext, and what's rendered into
+    void* display_;
+    void* context_;
+    std::unique_ptr<gfx::Framebuffer> target_;
+    bool closed_;
     std::string title_;
     int width_;
     int height_;
 
+    // frames left to draw before `waitInput` blocks again
+    std::atomic_int invalidatedFrames_;
+    // glfwGetTime at which the next `waitInput` returns anyway, see `invalidateIn`
+    double deadline_;
+
+    Presentation presentation_;
+    // seconds between two refreshes of the monitor
+    double refreshPeriod_;
+    // Presentation::LowLatency, glfwGetTime at which the next frame should be swapped, and when this one started
+    double frameDeadline_;
+    double frameStart_;
+    // how long frames take from `waitFrame` until their swap, quick to rise and slow to fall
+    double frameEstimate_;
+    // glfwGetTime of the first input event which isn't shown yet, or infinity
+    double inputTime_;
+    // ring buffer of the latest latencies, see `LATENCY_SAMPLES`
+    std::array<double, LATENCY_SAMPLES> latencies_;
+    size_t latencyCount_;
+    InputLatency inputLatency_;
+
     std::atomic_bool dialogOpen_;
     std::mutex dialogMutex_;
 
@@ -92,6 +216,7 @@ private:
         std::vector<std::function<void(int, int, int)>> key;
         std::vector<std::function<void(double, double)>> scroll;
         std::vector<std::function<void(int, int)>> resize;
+        std::vector<std::function<bool()>> idle;
     } listeners_;
 }; // class Window
 
@@ -41,6 +41,16 @@ target("tedit")
     add_packages("json")
     add_packages("cqueue");
 
+    -- headless rendering through EGL, see Window::Backend::Headless
+    if is_plat("linux") then
+        add_syslinks("EGL")
+    end
+
+    -- shaders are loaded at runtime, from next to the executable
+    after_build(function (target)
+        os.cp("res/shaders", target:targetdir())
+    end)
+
     if is_plat("windows") then 
         add_files("res/tedit.rc")
     end
\ No newline at end of file